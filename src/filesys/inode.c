@@ -36,6 +36,7 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned write_cnt;                 /* Number of writes to the data. */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -136,6 +137,7 @@ inode_open (block_sector_t sector)
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->write_cnt = 0;
   inode->removed = false;
   block_read (fs_device, inode->sector, &inode->data);
   return inode;
@@ -314,6 +316,8 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  if (bytes_written > 0)
+    inode->write_cnt++;
   return bytes_written;
 }
 
@@ -337,6 +341,14 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Returns the number of writes made to INODE's data since it was
+   opened.  Used to detect stale copies of its data. */
+unsigned
+inode_write_count (const struct inode *inode)
+{
+  return inode->write_cnt;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
@@ -21,6 +21,15 @@ enum {
 	/* Task 3 and optionally task 4. */
 	SYS_MMAP, /* Map a file into memory. */
 	SYS_MUNMAP, /* Remove a memory mapping. */
+	SYS_FORK, /* Duplicate the current process. */
+	SYS_RSS, /* Obtain the process's resident set size. */
+	SYS_SBRK, /* Move the program break. */
+	SYS_MMAP_ANON, /* Map anonymous memory. */
+	SYS_MSYNC, /* Write back mapped pages. */
+	SYS_MADVISE, /* Advise how mapped pages will be used. */
+	SYS_MLOCK, /* Lock pages in memory. */
+	SYS_MUNLOCK, /* Unlock pages locked in memory. */
+	SYS_MMAP_RANGE, /* Map part of a file into memory. */
 
 	NUM_SYSCALL, /* Number of syscalls we handle */
 
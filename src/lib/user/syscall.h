@@ -2,6 +2,8 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -12,6 +14,15 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Returned by sbrk() when the heap cannot be resized. */
+#define SBRK_FAILED ((void *) -1)
+
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_SEQUENTIAL 1       /* Read ahead, free pages behind early. */
+#define MADV_WILLNEED 2         /* Load the pages now. */
+#define MADV_DONTNEED 3         /* Drop the pages' clean contents. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -37,6 +48,15 @@ void close (int fd);
 /* Task 3 and optionally task 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+pid_t fork (void);
+int rss (void);
+void *sbrk (intptr_t increment);
+mapid_t mmap_anon (void *addr, size_t length);
+bool msync (void *addr, size_t length);
+bool madvise (void *addr, size_t length, int advice);
+bool mlock (void *addr, size_t length);
+bool munlock (void *addr, size_t length);
+mapid_t mmap_range (int fd, void *addr, unsigned offset, size_t length);
 
 /* Task 4 only. */
 bool chdir (const char *dir);
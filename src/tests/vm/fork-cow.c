@@ -0,0 +1,45 @@
+/* Fills 1 MB of memory then forks.  The child overwrites its
+   copy of the memory, and the parent verifies that its own copy
+   has not changed, so that pages are not shared once written. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+#define CHILD_EXIT 42
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Child: check the inherited memory, then overwrite it. */
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          fail ("child byte %zu is incorrect", i);
+      memset (buf, 0x5a, SIZE);
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != 0x5a)
+          fail ("child byte %zu != 0x5a", i);
+      exit (CHILD_EXIT);
+    }
+
+  CHECK (child != PID_ERROR, "fork");
+  CHECK (wait (child) == CHILD_EXIT, "wait for child");
+
+  msg ("verify parent memory");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("parent byte %zu is incorrect", i);
+}
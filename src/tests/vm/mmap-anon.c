@@ -0,0 +1,37 @@
+/* Maps anonymous memory, checks it is zeroed and usable, then
+   unmaps it and checks that the same address can be mapped
+   again with fresh zeroed pages. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (5 * 4096 + 100)
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  mapid_t map;
+  size_t i;
+
+  CHECK ((map = mmap_anon (actual, SIZE)) != MAP_FAILED, "mmap_anon");
+  CHECK (mmap_anon (actual + 4096, 4096) == MAP_FAILED,
+         "mmap_anon over mapping fails");
+
+  for (i = 0; i < SIZE; i++)
+    if (actual[i] != 0)
+      fail ("byte %zu of mapping != 0", i);
+  memset (actual, 0x5a, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (actual[i] != 0x5a)
+      fail ("byte %zu of mapping != 0x5a", i);
+
+  munmap (map);
+  CHECK ((map = mmap_anon (actual, SIZE)) != MAP_FAILED, "mmap_anon again");
+  for (i = 0; i < SIZE; i++)
+    if (actual[i] != 0)
+      fail ("byte %zu of new mapping != 0", i);
+  munmap (map);
+}
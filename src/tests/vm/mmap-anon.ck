@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-anon) begin
+(mmap-anon) mmap_anon
+(mmap-anon) mmap_anon over mapping fails
+(mmap-anon) mmap_anon again
+(mmap-anon) end
+EOF
+pass;
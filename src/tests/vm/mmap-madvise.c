@@ -0,0 +1,67 @@
+/* Maps a file larger than a few pages and reads it sequentially
+   after MADV_SEQUENTIAL, prefetches it with MADV_WILLNEED, then
+   drops it with MADV_DONTNEED after writing and flushing part
+   of it, checking the contents stay correct throughout.  Also
+   checks that anonymous pages read back as zeros after
+   MADV_DONTNEED. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (32 * 4096)
+#define ACTUAL ((char *) 0x10000000)
+#define ANON ((char *) 0x20000000)
+
+static char buf[4096];
+
+static void
+check_contents (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (ACTUAL[i] != (char) (i / 4096 + (i == 0 ? 0x11 : 0)))
+      fail ("byte %zu of mapping is wrong %s", i, name);
+}
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map, anon;
+  size_t i;
+
+  CHECK (create ("madvise", SIZE), "create \"madvise\"");
+  CHECK ((handle = open ("madvise")) > 1, "open \"madvise\"");
+  for (i = 0; i < SIZE / 4096; i++)
+    {
+      memset (buf, i, sizeof buf);
+      write (handle, buf, sizeof buf);
+    }
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"madvise\"");
+  CHECK (!madvise (ACTUAL, SIZE, 42), "madvise with bad advice fails");
+
+  /* The first byte is changed and flushed so that dropped clean
+     pages are read back with the new contents. */
+  ACTUAL[0] = 0x11;
+  CHECK (msync (ACTUAL, 4096), "msync first page");
+
+  CHECK (madvise (ACTUAL, SIZE, MADV_SEQUENTIAL), "madvise sequential");
+  check_contents ("after MADV_SEQUENTIAL");
+  CHECK (madvise (ACTUAL, SIZE, MADV_DONTNEED), "madvise dontneed");
+  check_contents ("after MADV_DONTNEED");
+  CHECK (madvise (ACTUAL, SIZE, MADV_WILLNEED), "madvise willneed");
+  check_contents ("after MADV_WILLNEED");
+  munmap (map);
+  close (handle);
+
+  CHECK ((anon = mmap_anon (ANON, 2 * 4096)) != MAP_FAILED, "mmap_anon");
+  memset (ANON, 0x5a, 2 * 4096);
+  CHECK (madvise (ANON, 2 * 4096, MADV_DONTNEED), "madvise anonymous");
+  for (i = 0; i < 2 * 4096; i++)
+    if (ANON[i] != 0)
+      fail ("byte %zu of anonymous mapping != 0", i);
+  munmap (anon);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "madvise"
+(mmap-madvise) open "madvise"
+(mmap-madvise) mmap "madvise"
+(mmap-madvise) madvise with bad advice fails
+(mmap-madvise) msync first page
+(mmap-madvise) madvise sequential
+(mmap-madvise) madvise dontneed
+(mmap-madvise) madvise willneed
+(mmap-madvise) mmap_anon
+(mmap-madvise) madvise anonymous
+(mmap-madvise) end
+EOF
+pass;
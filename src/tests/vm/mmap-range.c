@@ -0,0 +1,43 @@
+/* Writes a 3-page file, maps its middle page with mmap_range,
+   and checks the mapping holds that page.  Also checks that
+   mapping from a misaligned offset, from beyond the end of the
+   file, or of zero length fails. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ACTUAL ((void *) 0x10000000)
+
+static char buf[3 * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i / PAGE_SIZE + i % 251;
+  CHECK (create ("data", sizeof buf), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK (write (handle, buf, sizeof buf) == (int) sizeof buf,
+         "write \"data\"");
+
+  CHECK (mmap_range (handle, ACTUAL, 1, PAGE_SIZE) == MAP_FAILED,
+         "mmap_range from misaligned offset fails");
+  CHECK (mmap_range (handle, ACTUAL, sizeof buf, PAGE_SIZE) == MAP_FAILED,
+         "mmap_range beyond end of file fails");
+  CHECK (mmap_range (handle, ACTUAL, PAGE_SIZE, 0) == MAP_FAILED,
+         "mmap_range of zero length fails");
+
+  CHECK ((map = mmap_range (handle, ACTUAL, PAGE_SIZE, PAGE_SIZE))
+         != MAP_FAILED, "mmap_range middle page");
+  if (memcmp (ACTUAL, buf + PAGE_SIZE, PAGE_SIZE))
+    fail ("mapped page differs from the file's middle page");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-range) begin
+(mmap-range) create "data"
+(mmap-range) open "data"
+(mmap-range) write "data"
+(mmap-range) mmap_range from misaligned offset fails
+(mmap-range) mmap_range beyond end of file fails
+(mmap-range) mmap_range of zero length fails
+(mmap-range) mmap_range middle page
+(mmap-range) end
+EOF
+pass;
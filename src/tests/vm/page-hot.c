@@ -0,0 +1,45 @@
+/* Repeatedly updates a small hot set of memory, in between sweeps
+   over 2 MB of cold memory that does not fit in the user pool.  A
+   policy that tells the hot set apart keeps it resident through
+   the sweeps.  Used by `make vm-bench' to compare page
+   replacement policies. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOT_SIZE (64 * 1024)
+#define COLD_SIZE (2 * 1024 * 1024)
+#define ROUNDS 8
+#define HOT_PASSES 4
+
+static char hot[HOT_SIZE];
+static char cold[COLD_SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int round, pass;
+
+  msg ("initialize");
+  memset (hot, 0, sizeof hot);
+  memset (cold, 0x5a, sizeof cold);
+
+  msg ("run %d rounds", ROUNDS);
+  for (round = 0; round < ROUNDS; round++)
+    {
+      for (pass = 0; pass < HOT_PASSES; pass++)
+        for (i = 0; i < HOT_SIZE; i++)
+          hot[i]++;
+
+      for (i = 0; i < COLD_SIZE; i += 512)
+        if (cold[i] != 0x5a)
+          fail ("cold byte %zu != 0x5a in round %d", i, round);
+    }
+
+  msg ("verify");
+  for (i = 0; i < HOT_SIZE; i++)
+    if (hot[i] != ROUNDS * HOT_PASSES)
+      fail ("hot byte %zu != %d", i, ROUNDS * HOT_PASSES);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-hot) begin
+(page-hot) initialize
+(page-hot) run 8 rounds
+(page-hot) verify
+(page-hot) end
+EOF
+pass;
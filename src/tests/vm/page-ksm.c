@@ -0,0 +1,61 @@
+/* Fills pages with identical contents and polls the resident set
+   size reported by rss() until the same-page merging scanner (see
+   "-ksm") has merged them, which takes two scans a quarter of a
+   second apart.  Then checks their contents, and that a write to
+   each page leaves the other pages unchanged, so that merged pages
+   are copied on write. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+/* Gives up on merging after POLL_CNT polls of rss(), spinning
+   POLL_SPIN_CNT times between polls.  Generous, as the scans run
+   on timer ticks. */
+#define POLL_CNT 4096
+#define POLL_SPIN_CNT (64 * 1024)
+
+static char buf[PAGE_CNT * PAGE_SIZE]
+  __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  volatile size_t spin;
+  int before, after;
+  size_t i, poll;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % PAGE_SIZE % 251;
+  before = rss ();
+
+  msg ("wait for merging");
+  for (poll = 0; poll < POLL_CNT; poll++)
+    {
+      after = rss ();
+      if (after < before)
+        break;
+      for (spin = 0; spin < POLL_SPIN_CNT; spin++)
+        continue;
+    }
+
+  CHECK (after < before, "merging reduces rss");
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i % PAGE_SIZE % 251))
+      fail ("byte %zu is incorrect", i);
+
+  msg ("write each page");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = i;
+  for (i = 0; i < sizeof buf; i++)
+    {
+      char expected = i % PAGE_SIZE ? i % PAGE_SIZE % 251 : i / PAGE_SIZE;
+      if (buf[i] != expected)
+        fail ("byte %zu is incorrect after writes", i);
+    }
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-ksm) begin
+(page-ksm) wait for merging
+(page-ksm) merging reduces rss
+(page-ksm) write each page
+(page-ksm) end
+EOF
+pass;
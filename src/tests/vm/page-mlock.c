@@ -0,0 +1,45 @@
+/* Locks some pages in memory and checks that their contents
+   survive writing to 2 MB of other memory, which forces page
+   replacement.  Also checks that locking misaligned, unmapped or
+   too many pages fails. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define LOCKED_PAGES 16
+#define LOCK_LIMIT 64
+#define SIZE (2 * 1024 * 1024)
+
+static char locked[(LOCK_LIMIT + 2) * PAGE_SIZE]
+  __attribute__ ((aligned (PAGE_SIZE)));
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  CHECK (!mlock (locked + 1, PAGE_SIZE), "mlock misaligned fails");
+  CHECK (!mlock ((void *) 0x10000000, PAGE_SIZE), "mlock unmapped fails");
+  CHECK (!mlock (locked, (LOCK_LIMIT + 1) * PAGE_SIZE),
+         "mlock over limit fails");
+
+  memset (locked, 0x5a, LOCKED_PAGES * PAGE_SIZE);
+  CHECK (mlock (locked, LOCKED_PAGES * PAGE_SIZE), "mlock %d pages",
+         LOCKED_PAGES);
+
+  msg ("write 2 MB");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    memset (buf + i, i / PAGE_SIZE, PAGE_SIZE);
+
+  for (i = 0; i < LOCKED_PAGES * PAGE_SIZE; i++)
+    if (locked[i] != 0x5a)
+      fail ("byte %zu of locked pages != 0x5a", i);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("byte %zu of buffer is wrong", i);
+  CHECK (munlock (locked, LOCKED_PAGES * PAGE_SIZE), "munlock");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-mlock) begin
+(page-mlock) mlock misaligned fails
+(page-mlock) mlock unmapped fails
+(page-mlock) mlock over limit fails
+(page-mlock) mlock 16 pages
+(page-mlock) write 2 MB
+(page-mlock) munlock
+(page-mlock) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Forks a child that writes to more pages than fit in memory and
+   swap together.  The child must be killed when memory runs out,
+   rather than the kernel panicking, and the parent must keep its
+   own memory intact. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SMALL_CNT 64
+#define HUGE_SIZE (8 * 1024 * 1024)
+
+static char small[SMALL_CNT * PAGE_SIZE];
+static char huge[HUGE_SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < sizeof small; i++)
+    small[i] = i % 251;
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Child: write to every page until killed. */
+      for (i = 0; i < HUGE_SIZE; i += PAGE_SIZE)
+        huge[i] = i / PAGE_SIZE;
+      exit (0);
+    }
+
+  CHECK (child != PID_ERROR, "fork");
+  CHECK (wait (child) == -1, "wait for child");
+
+  msg ("verify parent memory");
+  for (i = 0; i < sizeof small; i++)
+    if (small[i] != (char) (i % 251))
+      fail ("parent byte %zu is incorrect", i);
+}
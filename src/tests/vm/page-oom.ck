@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-oom) begin
+(page-oom) fork
+(page-oom) wait for child
+(page-oom) verify parent memory
+(page-oom) end
+EOF
+pass;
@@ -0,0 +1,34 @@
+/* Checks that the resident set size reported by rss() grows as
+   pages are touched, and does not count pages only read from
+   (which map the shared zero frame). */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  int before, after;
+  volatile char sum = 0;
+  size_t i;
+
+  before = rss ();
+  CHECK (before > 0, "rss of running process is positive");
+
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    sum += buf[i];
+  after = rss ();
+  CHECK (after < before + PAGE_CNT, "reading zero pages adds no rss");
+
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    buf[i] = 1;
+  after = rss ();
+  CHECK (after >= before + PAGE_CNT, "writing %d pages adds to rss",
+         PAGE_CNT);
+}
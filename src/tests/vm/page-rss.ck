@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rss) begin
+(page-rss) rss of running process is positive
+(page-rss) reading zero pages adds no rss
+(page-rss) writing 64 pages adds to rss
+(page-rss) end
+EOF
+pass;
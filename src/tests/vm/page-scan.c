@@ -0,0 +1,33 @@
+/* Repeatedly scans through 2 MB of memory, more than fits in the
+   user pool, checking its contents on every pass.  Each page is
+   used once per scan, so this is the worst case for a policy that
+   keeps recently used pages.  Used by `make vm-bench' to compare
+   page replacement policies. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define SCANS 4
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int scan;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  for (scan = 0; scan < SCANS; scan++)
+    {
+      msg ("scan %d", scan);
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          fail ("byte %zu != %d in scan %d", i, (int) (i % 251), scan);
+    }
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-scan) begin
+(page-scan) initialize
+(page-scan) scan 0
+(page-scan) scan 1
+(page-scan) scan 2
+(page-scan) scan 3
+(page-scan) end
+EOF
+pass;
@@ -0,0 +1,34 @@
+/* Writes one byte to each 64 kB block of a zeroed array, and checks
+   that the rest of each block is loaded by the same page fault
+   (adding more to the resident set size than the pages written),
+   and that the whole array still reads as zeros apart from the
+   bytes written. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define BLOCK_SIZE (16 * PAGE_SIZE)
+#define BLOCK_CNT 8
+
+static char buf[BLOCK_CNT * BLOCK_SIZE]
+  __attribute__ ((aligned (BLOCK_SIZE)));
+
+void
+test_main (void)
+{
+  int before, after;
+  size_t i;
+
+  before = rss ();
+  for (i = 0; i < sizeof buf; i += BLOCK_SIZE)
+    buf[i] = 1;
+  after = rss ();
+  CHECK (after - before > BLOCK_CNT, "writing %d blocks loads whole blocks",
+         BLOCK_CNT);
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (i % BLOCK_SIZE == 0))
+      fail ("byte %zu is incorrect", i);
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero-block) begin
+(page-zero-block) writing 8 blocks loads whole blocks
+(page-zero-block) end
+EOF
+pass;
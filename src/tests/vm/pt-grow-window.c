@@ -0,0 +1,30 @@
+/* Grows the stack by writing to a large stack object from the
+   top down, and checks with rss() that a stack fault loads more
+   than the faulting page, so that the stack has already been
+   grown when it reaches the pages below. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 32
+
+void
+test_main (void)
+{
+  char buf[PAGE_CNT * PAGE_SIZE];
+  int before, after;
+  size_t i;
+
+  before = rss ();
+  buf[sizeof buf / 2] = 1;
+  after = rss ();
+  CHECK (after > before + 1, "stack fault loads more than one page");
+
+  for (i = sizeof buf; i > 0; i -= PAGE_SIZE)
+    buf[i - 1] = i / PAGE_SIZE;
+  for (i = sizeof buf; i > 0; i -= PAGE_SIZE)
+    if (buf[i - 1] != (char) (i / PAGE_SIZE))
+      fail ("byte %zu is incorrect", i - 1);
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pt-grow-window) begin
+(pt-grow-window) stack fault loads more than one page
+(pt-grow-window) end
+EOF
+pass;
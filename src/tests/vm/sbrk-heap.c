@@ -0,0 +1,39 @@
+/* Grows the heap with sbrk(), checks the new memory is zeroed
+   and usable, then shrinks it back and grows it again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+void
+test_main (void)
+{
+  char *heap, *end;
+  size_t i;
+
+  heap = sbrk (0);
+  CHECK (heap != SBRK_FAILED, "sbrk (0)");
+
+  CHECK (sbrk (SIZE) == heap, "sbrk (%d)", SIZE);
+  end = sbrk (0);
+  CHECK (end == heap + SIZE, "break moved by %d", SIZE);
+
+  for (i = 0; i < SIZE; i++)
+    if (heap[i] != 0)
+      fail ("byte %zu of new heap != 0", i);
+  memset (heap, 0x5a, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (heap[i] != 0x5a)
+      fail ("byte %zu of heap != 0x5a", i);
+
+  CHECK (sbrk (-SIZE) == end, "sbrk (-%d)", SIZE);
+  CHECK (sbrk (-1) == SBRK_FAILED, "shrink below heap start fails");
+
+  CHECK (sbrk (SIZE) == heap, "sbrk (%d) again", SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (heap[i] != 0)
+      fail ("byte %zu of regrown heap != 0", i);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sbrk-heap) begin
+(sbrk-heap) sbrk (0)
+(sbrk-heap) sbrk (65536)
+(sbrk-heap) break moved by 65536
+(sbrk-heap) sbrk (-65536)
+(sbrk-heap) shrink below heap start fails
+(sbrk-heap) sbrk (65536) again
+(sbrk-heap) end
+EOF
+pass;
@@ -26,6 +26,7 @@
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -39,6 +40,8 @@
 #endif
 #ifdef VM
 #include "vm/mmap.h"
+#include "vm/cow.h"
+#include "vm/ksm.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -61,6 +64,21 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef USERPROG
+/* -rl: Number of resident pages a process can have before page replacement
+ * evicts its pages first, zero for no limit.
+ */
+static size_t resident_limit;
+#endif
+
+#ifdef VM
+/* -rp: Name of the page replacement policy, overriding the default. */
+static const char *replacement_policy_name;
+
+/* -ksm: Merge identical pages of processes? */
+static bool ksm_enabled;
+#endif
+
 static void bss_init(void);
 static void paging_init(void);
 
@@ -107,6 +125,7 @@ int main(void)
 #ifdef USERPROG
 	tss_init();
 	gdt_init();
+	pagedir_init(resident_limit);
 #endif
 
 	/* Initialize interrupt handlers. */
@@ -123,6 +142,9 @@ int main(void)
 	thread_start();
 	serial_init_queue();
 	timer_calibrate();
+#ifdef USERPROG
+	process_init();
+#endif
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -131,9 +153,11 @@ int main(void)
 	filesys_init(format_filesys);
 #endif
 #ifdef VM
-	frame_init();
+	frame_init(replacement_policy_name);
 	swap_init();
 	mmap_init();
+	cow_init();
+	ksm_init(ksm_enabled);
 #endif
 
 	printf("Boot complete.\n");
@@ -265,6 +289,14 @@ static char **parse_options(char **argv)
 #ifdef USERPROG
 		else if (!strcmp(name, "-ul"))
 			user_page_limit = atoi(value);
+		else if (!strcmp(name, "-rl"))
+			resident_limit = atoi(value);
+#endif
+#ifdef VM
+		else if (!strcmp(name, "-rp"))
+			replacement_policy_name = value;
+		else if (!strcmp(name, "-ksm"))
+			ksm_enabled = true;
 #endif
 		else
 			PANIC("unknown option `%s' (use -h for help)", name);
@@ -383,6 +415,13 @@ static void usage(void)
 				 "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 				 "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+				 "  -rl=COUNT          Evict pages of processes with over COUNT\n"
+				 "                     resident pages first.\n"
+#endif
+#ifdef VM
+				 "  -rp=POLICY         Use POLICY for page replacement (clock,\n"
+				 "                     wsclock or 2q).\n"
+				 "  -ksm               Merge identical pages of processes.\n"
 #endif
 	);
 	shutdown_power_off();
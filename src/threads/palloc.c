@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -26,12 +27,35 @@
  * By default, half of system RAM is given to the kernel pool and
  * half to the user pool.  That should be huge overkill for the
  * kernel pool, but that's just fine for demonstration purposes.
+ *
+ * Each pool also tracks which of its free pages are known to be
+ * zeroed.  The idle thread fills these in (see palloc_prezero()),
+ * so that single page PAL_ZERO allocations can usually skip the
+ * memset.  Only free pages can be marked as zeroed, allocating a
+ * page always clears its zeroed bit.
+ *
+ * Zeroed pages are taken from the lowest free pages that are not
+ * zeroed, so they gather at the bottom of the pool.  Allocations
+ * not asking for zeroes start looking for an unzeroed page at a
+ * hint past them, rather than stepping over every zeroed page.
+ * Pages are freed without the pool lock, so the hint can be left
+ * too high, in which case an unzeroed page is passed over and a
+ * zeroed one may be used instead until a lower page is freed.
  */
 
+/* The idle thread stops zeroing pages once 1 / ZEROED_FRACTION of
+ * a pool's pages are zeroed, leaving the rest for allocations that
+ * do not need zeroed memory.
+ */
+#define ZEROED_FRACTION 4
+
 /* A memory pool. */
 struct pool {
 	struct lock lock; /* Mutual exclusion. */
 	struct bitmap *used_map; /* Bitmap of free pages. */
+	struct bitmap *zeroed_map; /* Bitmap of free pages that are zeroed. */
+	size_t zeroed_cnt; /* Number of pages set in zeroed_map. */
+	size_t unzeroed_hint; /* Free pages below are zeroed (a hint). */
 	uint8_t *base; /* Base of pool. */
 };
 
@@ -41,6 +65,9 @@ static struct pool kernel_pool, user_pool;
 static void init_pool(struct pool *, void *base, size_t page_cnt,
 											const char *name);
 static bool page_from_pool(const struct pool *, void *page);
+static size_t scan_unzeroed(struct pool *pool);
+static void lower_unzeroed_hint(struct pool *pool, size_t page_idx);
+static bool prezero_pool(struct pool *pool);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
  * pages are put into the user pool.
@@ -72,21 +99,40 @@ uint32_t palloc_pool_count_free(bool user)
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
  * If PAL_USER is set, the pages are obtained from the user pool,
  * otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
- * then the pages are filled with zeros.  If too few pages are
- * available, returns a null pointer, unless PAL_ASSERT is set in
- * FLAGS, in which case the kernel panics.
+ * then the pages are filled with zeros, single pages are taken
+ * from those already zeroed by the idle thread when possible.  If
+ * too few pages are available, returns a null pointer, unless
+ * PAL_ASSERT is set in FLAGS, in which case the kernel panics.
  */
 void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt)
 {
 	struct pool *pool = (flags & PAL_USER) ? &user_pool : &kernel_pool;
 	void *pages;
-	size_t page_idx;
+	size_t page_idx = BITMAP_ERROR;
+	bool zeroed = false;
 
 	if (page_cnt == 0)
 		return NULL;
 
 	lock_acquire(&pool->lock);
-	page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+	if (page_cnt == 1) {
+		/* Use a zeroed page only when zeroes were asked for. */
+		if (flags & PAL_ZERO)
+			page_idx = bitmap_scan(pool->zeroed_map, 0, 1, true);
+		else
+			page_idx = scan_unzeroed(pool);
+		if (page_idx != BITMAP_ERROR)
+			bitmap_mark(pool->used_map, page_idx);
+	}
+	if (page_idx == BITMAP_ERROR)
+		page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR) {
+		size_t zeroed_cnt =
+			bitmap_count(pool->zeroed_map, page_idx, page_cnt, true);
+		zeroed = zeroed_cnt == page_cnt;
+		pool->zeroed_cnt -= zeroed_cnt;
+		bitmap_set_multiple(pool->zeroed_map, page_idx, page_cnt, false);
+	}
 	lock_release(&pool->lock);
 
 	if (page_idx != BITMAP_ERROR)
@@ -95,7 +141,7 @@ void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt)
 		pages = NULL;
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset(pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -143,6 +189,7 @@ void palloc_free_multiple(void *pages, size_t page_cnt)
 
 	ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+	lower_unzeroed_hint(pool, page_idx);
 }
 
 /* Frees the page at PAGE. */
@@ -151,17 +198,95 @@ void palloc_free_page(void *page)
 	palloc_free_multiple(page, 1);
 }
 
+/* Zeroes a single free page, so that a later PAL_ZERO allocation
+ * can take it without waiting on a memset.  Called from the idle
+ * thread, so must never block.  Returns true if a page was zeroed,
+ * false if there was nothing to do (or a pool was busy).
+ */
+bool palloc_prezero(void)
+{
+	return prezero_pool(&user_pool) || prezero_pool(&kernel_pool);
+}
+
+/* Zeroes a free page in POOL if it is below its target of zeroed
+ * pages.  The pool lock is only ever tried with interrupts off, so
+ * the idle thread is never preempted while holding it, and no
+ * thread can end up waiting on (or donating to) the idle thread.
+ */
+static bool prezero_pool(struct pool *pool)
+{
+	size_t target = bitmap_size(pool->used_map) / ZEROED_FRACTION;
+	size_t page_idx = BITMAP_ERROR;
+	enum intr_level old_level = intr_disable();
+
+	if (pool->zeroed_cnt < target && lock_try_acquire(&pool->lock)) {
+		/* Claim the page so no one allocates it while we zero it. */
+		page_idx = scan_unzeroed(pool);
+		if (page_idx != BITMAP_ERROR)
+			bitmap_mark(pool->used_map, page_idx);
+		lock_release(&pool->lock);
+	}
+	intr_set_level(old_level);
+
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	memset(pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+	/* If the pool is busy, the page is still freed, just not marked zeroed. */
+	old_level = intr_disable();
+	if (lock_try_acquire(&pool->lock)) {
+		bitmap_mark(pool->zeroed_map, page_idx);
+		pool->zeroed_cnt++;
+		bitmap_reset(pool->used_map, page_idx);
+		lock_release(&pool->lock);
+	} else {
+		bitmap_reset(pool->used_map, page_idx);
+		lower_unzeroed_hint(pool, page_idx);
+	}
+	intr_set_level(old_level);
+	return true;
+}
+
+/* Returns the index of the first free page in POOL that is not
+ * zeroed at or above its unzeroed hint, or BITMAP_ERROR if there
+ * is none, moving the hint up to it.  The caller must hold the
+ * pool lock.
+ */
+static size_t scan_unzeroed(struct pool *pool)
+{
+	size_t page_idx = pool->unzeroed_hint;
+
+	while ((page_idx = bitmap_scan(pool->used_map, page_idx, 1, false)) !=
+						 BITMAP_ERROR &&
+				 bitmap_test(pool->zeroed_map, page_idx))
+		page_idx++;
+	pool->unzeroed_hint =
+		page_idx != BITMAP_ERROR ? page_idx : bitmap_size(pool->used_map);
+	return page_idx;
+}
+
+/* Moves the unzeroed hint of POOL down to PAGE_IDX, a page that
+ * has just been freed without being zeroed.
+ */
+static void lower_unzeroed_hint(struct pool *pool, size_t page_idx)
+{
+	if (page_idx < pool->unzeroed_hint)
+		pool->unzeroed_hint = page_idx;
+}
+
 /* Initializes pool P as starting at START and ending at END,
  * naming it NAME for debugging purposes.
  */
 static void init_pool(struct pool *p, void *base, size_t page_cnt,
 											const char *name)
 {
-	/* We'll put the pool's used_map at its base.
-	 * Calculate the space needed for the bitmap
+	/* We'll put the pool's used_map and zeroed_map at its base.
+	 * Calculate the space needed for the bitmaps
 	 * and subtract it from the pool's size.
 	 */
-	size_t bm_pages = DIV_ROUND_UP(bitmap_buf_size(page_cnt), PGSIZE);
+	size_t bm_size = bitmap_buf_size(page_cnt);
+	size_t bm_pages = DIV_ROUND_UP(2 * bm_size, PGSIZE);
 	if (bm_pages > page_cnt)
 		PANIC("Not enough memory in %s for bitmap.", name);
 	page_cnt -= bm_pages;
@@ -170,7 +295,10 @@ static void init_pool(struct pool *p, void *base, size_t page_cnt,
 
 	/* Initialize the pool. */
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf(page_cnt, base, bm_pages * PGSIZE);
+	p->used_map = bitmap_create_in_buf(page_cnt, base, bm_size);
+	p->zeroed_map = bitmap_create_in_buf(page_cnt, base + bm_size, bm_size);
+	p->zeroed_cnt = 0;
+	p->unzeroed_hint = 0;
 	p->base = base + bm_pages * PGSIZE;
 }
 
@@ -35,5 +35,6 @@ void *palloc_get_page(enum palloc_flags);
 void *palloc_get_multiple(enum palloc_flags, size_t page_cnt);
 void palloc_free_page(void *page);
 void palloc_free_multiple(void *pages, size_t page_cnt);
+bool palloc_prezero(void);
 
 #endif /* threads/palloc.h */
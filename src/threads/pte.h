@@ -4,7 +4,7 @@
 #include "threads/vaddr.h"
 
 #ifdef VM
-#include "vm/lazy.h"
+#include "vm/cow.h"
 #include "vm/mmap.h"
 #include "vm/swap.h"
 #endif
@@ -96,38 +96,59 @@ static inline uintptr_t pd_no(const void *va)
  * The swap slot id is used with swap_load(swap_id) to identify swapped
  * pages & load them back into memory.
  *
- * 31               MMAP/LAZY PAGE (NOT IN MEMORY)           2 1 0
+ * 31           MMAP/REGION/COW PAGE (NOT IN MEMORY)         2 1 0
  * +-+-----------------------------------------------------------+
  * |                     POINTER TO STRUCT                    |10|
  * +-+-----------------------------------------------------------+
- * Contains a pointer to a user_mmap or lazy_page struct. Due to pointer
- * alignment by malloc, the last two bits of any malloc will be zero. Hence we
- * can use these to identify (10 = pointer & frame not present).
+ * Contains a pointer to a user_mmap, mmap_region or cow_user struct. Due to
+ * pointer alignment by malloc, the last two bits of any malloc will be zero.
+ * Hence we can use these to identify (10 = pointer & frame not present).
  *
  * To identify which type of struct, a value at the top of the malloc identifies
  * the following struct.
  *
- *             +-----------+                +-----------+
- * Pointer ==> |    true   | OR Pointer ==> |   false   |
- *             +-----------+                +-----------+
- *             | lazy_page |                | user_mmap |
- *             |    ...    |                |    ...    |
- *             +-----------+                +-----------+
+ *             +--------------+   +----------------+   +--------------+
+ * Pointer ==> | POINTER_MMAP |OR | POINTER_REGION |OR | POINTER_COW  |
+ *             +--------------+   +----------------+   +--------------+
+ *             |  user_mmap   |   |  mmap_region   |   |   cow_user   |
+ *             |     ...      |   |      ...       |   |     ...      |
+ *             +--------------+   +----------------+   +--------------+
  *
- * This is easy to extend by using more bits (e.g enum instead of bool) for
- * implementation of different page types such as COW (Copy on write) shared
- * pages.
+ * Present pages use the available bits [11-9] of the page table entry:
+ *
+ * 31                ZERO PAGE (IN MEMORY)     12 11 10  9 8       0
+ * +-------------------------------------------+--+---+--+---------+
+ * |         ADDRESS OF THE SHARED ZERO FRAME  |  |ZPW|ZP|  FLAGS  |
+ * +-------------------------------------------+--+---+--+---------+
+ * Lazy-zeroed pages that are only read are mapped read-only to a single shared
+ * frame of zeros. The ZPW bit records if the page should become a private
+ * writable frame on the first write to it.
+ *
+ * 31              COW PAGE (IN MEMORY)        12 11 10  9 8       0
+ * +-------------------------------------------+---+--+--+---------+
+ * |      ADDRESS OF THE SHARED FRAME          |COW|  |  |  FLAGS  |
+ * +-------------------------------------------+---+--+--+---------+
+ * Copy on write pages are mapped read-only to the frame shared between forked
+ * processes. A write to the page gives the process its own copy (see cow.c).
  */
 
-#define PTE_PTR 0x2 /* 1=pointer pte (lazy/mmap page), 0=not. */
+#define PTE_PTR 0x2 /* 1=pointer pte (mmap/region/cow page), 0=not. */
 #define PTE_S 0x4 /* 1=in swap, 0=not in swap. */
 #define PTE_Z 0x8 /* 1=should be zeroed, 0=shouldn't be zeroed. */
 #define PTE_ZW 0x10 /* Zeroed page 1=writeable, 0=read-only. */
 #define PTE_ZAUX_SHIFT 5 /* Bits to shift aux pte by in zeroed pte. */
 #define PTE_SWAPID_SHIFT 3 /* Bits to shift swap pte by to get swap id. */
-#define PTE_PTRMASK 0xfffffffc /* Mask to get pointer for lazy/mmap page. */
+#define PTE_PTRMASK 0xfffffffc /* Mask to get pointer for pointer pte. */
+#define PTE_ZP 0x200 /* 1=present page maps the shared zero frame. */
+#define PTE_ZPW 0x400 /* Zero page 1=copy on write, 0=read-only. */
+#define PTE_COW 0x800 /* 1=present page is a shared copy on write frame. */
 
-enum page_type { NOTSET, ZEROED, SWAPPED, MMAPED, LAZY, PAGEDIN };
+enum page_type { NOTSET, ZEROED, SWAPPED, MMAPED, REGION, COW, PAGEDIN };
+
+/* Identifies the struct pointed to by a pointer pte, must be the first member
+ * of each struct.
+ */
+enum pte_pointer_type { POINTER_MMAP, POINTER_REGION, POINTER_COW };
 
 #endif
 
@@ -192,7 +213,7 @@ static inline uint32_t pte_set_dirty(uint32_t pte, bool dirty)
 
 #ifdef VM
 
-/* Extracts the pointer to a lazy/mmap page from the page table entry PTE. */
+/* Extracts the pointer to a mmap/cow page from the page table entry PTE. */
 static inline void *pte_get_pointer(uint32_t pte)
 {
 	return ptov(pte & PTE_PTRMASK);
@@ -203,8 +224,16 @@ static inline enum page_type pte_get_type(uint32_t pte)
 {
 	if (pte & PTE_P)
 		return PAGEDIN;
-	if (pte & PTE_PTR)
-		return *(bool *)pte_get_pointer(pte) ? LAZY : MMAPED;
+	if (pte & PTE_PTR) {
+		switch (*(enum pte_pointer_type *)pte_get_pointer(pte)) {
+		case POINTER_REGION:
+			return REGION;
+		case POINTER_COW:
+			return COW;
+		default:
+			return MMAPED;
+		}
+	}
 	if (pte & PTE_S)
 		return SWAPPED;
 	if (pte & PTE_Z)
@@ -244,21 +273,19 @@ static inline uint32_t pte_create_mmaped(struct user_mmap *mmap)
 	return vtop(mmap) | PTE_PTR;
 }
 
-/* Create a page table entry for a lazy loaded page. Will contain a pointer to
- * the lazy_load struct.
- *
- * Pointer bits [31-3] are in tpe bits [31-3].
+/* Create a page table entry for a page of an mmaped region that has not been
+ * registered yet, using the pointer to the mmap_region REGION.
  */
-static inline uint32_t pte_create_lazy_load(struct lazy_load *lazy)
+static inline uint32_t pte_create_region(struct mmap_region *region)
 {
-	ASSERT((vtop(lazy) & PTE_PTRMASK) == vtop(lazy));
-	return vtop(lazy) | PTE_PTR;
+	ASSERT((vtop(region) & PTE_PTRMASK) == vtop(region));
+	return vtop(region) | PTE_PTR;
 }
 
-/* Get lazy load pointer fro page table entry PTE. */
-static inline struct lazy_load *pte_get_lazy_load(uint32_t pte)
+/* Get the mmap_region pointer from page table entry PTE. */
+static inline struct mmap_region *pte_get_region(uint32_t pte)
 {
-	ASSERT(pte_get_type(pte) == LAZY);
+	ASSERT(pte_get_type(pte) == REGION);
 	return pte_get_pointer(pte);
 }
 
@@ -286,6 +313,59 @@ static inline uint32_t pte_get_zeroed_aux(uint32_t pte)
 	return pte >> PTE_ZAUX_SHIFT;
 }
 
+/* Create a page table entry for a copy on write page that is not in memory.
+ * Will contain a pointer to the cow_user struct.
+ *
+ * Pointer bits [31-3] are in pte bits [31-3].
+ */
+static inline uint32_t pte_create_cow_user(struct cow_user *cow_user)
+{
+	ASSERT((vtop(cow_user) & PTE_PTRMASK) == vtop(cow_user));
+	return vtop(cow_user) | PTE_PTR;
+}
+
+/* Get the cow_user pointer from page table entry PTE. */
+static inline struct cow_user *pte_get_cow_user(uint32_t pte)
+{
+	ASSERT(pte_get_type(pte) == COW);
+	return pte_get_pointer(pte);
+}
+
+/* Create a read-only page table entry mapping the copy on write frame KPAGE. */
+static inline uint32_t pte_create_cow(void *kpage)
+{
+	return pte_create_user(kpage, false) | PTE_COW;
+}
+
+/* Return true if the page table entry PTE maps a copy on write frame. */
+static inline bool pte_is_cow(uint32_t pte)
+{
+	return (pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW);
+}
+
+/* Create a read-only page table entry mapping the shared ZERO_PAGE. If WRITABLE
+ * the page is given a private frame on the first write to it.
+ */
+static inline uint32_t pte_create_zero_page(void *zero_page, bool writable)
+{
+	return pte_create_user(zero_page, false) | (PTE_ZPW * writable) | PTE_ZP;
+}
+
+/* Return true if the page table entry PTE maps the shared zero frame. */
+static inline bool pte_is_zero_page(uint32_t pte)
+{
+	return (pte & (PTE_P | PTE_ZP)) == (PTE_P | PTE_ZP);
+}
+
+/* Return true if the zero page mapped by PTE can be written to (after being
+ * given its own frame).
+ */
+static inline bool pte_is_zero_page_writeable(uint32_t pte)
+{
+	ASSERT(pte_is_zero_page(pte));
+	return pte & PTE_ZPW;
+}
+
 #endif
 
 /* Set a page table entry PTE's access to ACCESSED. */
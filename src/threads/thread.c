@@ -619,6 +619,12 @@ static void idle(void *idle_started_ UNUSED)
 	sema_up(idle_started);
 
 	for (;;) {
+		/* Zero free pages in the time otherwise spent halted, so that
+		 * PAL_ZERO allocations can skip the memset.
+		 */
+		while (threads_ready() == 0 && palloc_prezero())
+			continue;
+
 		/* Let someone else run. */
 		intr_disable();
 		thread_block();
@@ -710,6 +716,12 @@ static void init_thread(struct thread *t, const char *name)
 #ifdef USERPROG
 	list_init(&t->children);
 	t->pagedir = NULL;
+	t->tlb_batch_depth = 0;
+	t->tlb_flush_pending = false;
+#ifdef VM
+	lock_init(&t->ksm_lock);
+	t->ksm_registered = false;
+#endif
 #endif
 
 	old_level = intr_disable();
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <vector.h>
+#include <hash.h>
 #include <bitmap.h>
 #include <stdint.h>
 #include "threads/donation.h"
@@ -122,14 +123,23 @@ struct thread {
 	bool may_page_fault; /* For debugging kernel */
 #endif
 	uint32_t *pagedir; /* Page directory. */
+	unsigned tlb_batch_depth; /* Nesting depth of pagedir_batch_begin(). */
+	bool tlb_flush_pending; /* TLB flush deferred to the end of the batch. */
 	struct vector open_files; /* Vector of open file structs */
 	struct list children; /* List of child processes */
 	struct child_manager *parent; /* Struct managing the child process */
 #ifndef VM
 	struct file *exec_file; /* The program file the thread is running */
 #else
-	struct vector mmapings; /* Maps mmap ids to malloced lists of pages is uses */
+	struct vector mmapings; /* Maps mmap ids to malloced struct mmapings. */
 	struct list exec_file_mmapings; /* list of executable pages' user_mmaps. */
+	struct hash private_mmaps; /* Maps virtual pages to private user_mmaps. */
+	struct hash cow_users; /* Maps virtual pages to copy on write cow_users. */
+	uint8_t *heap_start; /* First page after the executable's segments. */
+	uint8_t *brk; /* End of the heap (the program break). */
+	struct lock ksm_lock; /* Held while pages are scanned for merging. */
+	struct list_elem ksm_elem; /* List element for the merging scanner. */
+	bool ksm_registered; /* Whether the merging scanner scans the process. */
 #endif
 #endif
 	/* Owned by thread.c. */
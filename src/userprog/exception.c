@@ -8,9 +8,11 @@
 #ifdef VM
 #include <string.h>
 #include "threads/pte.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
-#include "vm/lazy.h"
+#include "vm/cow.h"
+#include "vm/frame.h"
 #include "vm/mmap.h"
 #include "vm/swap.h"
 #endif
@@ -20,6 +22,27 @@ static long long page_fault_cnt;
 
 static void kill(struct intr_frame *);
 static void page_fault(struct intr_frame *);
+#ifdef VM
+/* The number of pages in an aligned block of zeroed pages loaded by a single
+ * write fault, see load_zeroed_block().
+ */
+#define ZEROED_BLOCK_PAGES 16
+
+/* The maximum number of stack pages loaded by a single page fault, see
+ * load_stack_pages().
+ */
+#define STACK_GROW_PAGES 8
+
+/* The maximum number of swapped pages loaded by a single page fault, see
+ * load_swapped_pages().
+ */
+#define SWAP_IN_PAGES 16
+
+static void load_zeroed_page(void *vpage, bool writable);
+static void load_zeroed_block(void *vpage);
+static void load_stack_pages(void *vpage);
+static void load_swapped_pages(void *vpage, swapid_t swap_id);
+#endif
 
 /* Registers handlers for interrupts that can be caused by user
  * programs.
@@ -120,6 +143,161 @@ static void kill(struct intr_frame *f)
 	}
 }
 
+#ifdef VM
+/* Load a lazy-zeroed page VPAGE of the current process into memory:
+ * 1. Get a new locked frame of all-zeros (potentially by page replacement,
+ *    or one already zeroed by the idle thread).
+ * 2. Set the page table entry to the zeroed frame, with writability
+ *    WRITABLE.
+ * 3. Unlock the frame (now can be page replaced as normal), and mark as a
+ *    swappable page (evicted to swap space e.g like stack).
+ */
+static void load_zeroed_page(void *vpage, bool writable)
+{
+	void *kpage = frame_get_zeroed();
+	if (!pagedir_set_page(thread_current()->pagedir, vpage, kpage, writable))
+		NOT_REACHED();
+	frame_unlock_swappable(thread_current()->pagedir, vpage, kpage);
+}
+
+/* Load the writable lazy-zeroed page VPAGE of the current process, along with
+ * the other pages in its aligned block of ZEROED_BLOCK_PAGES if every page of
+ * the block is writable and lazy-zeroed (e.g. a large array in the BSS, heap or
+ * an anonymous mmap):
+ * 1. Load VPAGE as in LOAD_ZEROED_PAGE.
+ * 2. Get zeroed frames for the rest of the block, but only while free frames
+ *    are available (no page replacement) and the process is within its
+ *    resident limit.
+ * 3. Set the page table entries, and unlock the frames as swappable pages.
+ *
+ * Processes writing through a large region would otherwise take a page fault
+ * for every page. Blocks only partially zeroed, and pages in the stack, are
+ * loaded a page at a time.
+ */
+static void load_zeroed_block(void *vpage)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *block = (uint8_t *)((uintptr_t)vpage &
+															 ~(uintptr_t)(ZEROED_BLOCK_PAGES * PGSIZE - 1));
+
+	load_zeroed_page(vpage, true);
+	if (block + ZEROED_BLOCK_PAGES * PGSIZE > (uint8_t *)STACK_BOTTOM)
+		return;
+
+	/* Only this process sets its own zeroed pages, so they cannot change under
+	 * us.
+	 */
+	for (size_t i = 0; i < ZEROED_BLOCK_PAGES; i++) {
+		uint32_t pte_val = pagedir_get_raw_pte(pd, block + i * PGSIZE);
+		if (block + i * PGSIZE != vpage &&
+				(pte_get_type(pte_val) != ZEROED || !pte_is_zeroed_writeable(pte_val)))
+			return;
+	}
+
+	for (size_t i = 0; i < ZEROED_BLOCK_PAGES; i++) {
+		uint8_t *next_vpage = block + i * PGSIZE;
+		if (next_vpage == vpage)
+			continue;
+		if (pagedir_over_resident_limit(pd))
+			return;
+
+		void *kpage = frame_try_get_zeroed();
+		if (!kpage)
+			return;
+		if (!pagedir_set_page(pd, next_vpage, kpage, true))
+			NOT_REACHED();
+		frame_unlock_swappable(pd, next_vpage, kpage);
+	}
+}
+
+/* Load the lazy-zeroed stack page VPAGE of the current process, along with up
+ * to STACK_GROW_PAGES - 1 lazy-zeroed pages directly below it, as a growing
+ * stack (e.g. deep recursion) is about to reach them:
+ * 1. Load VPAGE as in LOAD_ZEROED_PAGE.
+ * 2. Get zeroed frames for the pages below, but only while free frames are
+ *    available (no page replacement), the process is within its resident limit
+ *    and the pages are still lazy-zeroed. The guard page at the bottom of the
+ *    stack is never set (see SETUP_STACK()), so the window stops above it.
+ * 3. Set the page table entries, and unlock the frames as swappable pages.
+ *
+ * Pages already loaded below VPAGE also stop the window, so it is only
+ * extended when the stack grows below its lowest page.
+ */
+static void load_stack_pages(void *vpage)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *next_vpage = vpage;
+
+	load_zeroed_page(vpage, true);
+	for (size_t i = 1; i < STACK_GROW_PAGES; i++) {
+		next_vpage -= PGSIZE;
+		if (next_vpage < (uint8_t *)STACK_BOTTOM ||
+				pagedir_get_page_type(pd, next_vpage) != ZEROED ||
+				pagedir_over_resident_limit(pd))
+			return;
+
+		void *kpage = frame_try_get_zeroed();
+		if (!kpage)
+			return;
+		if (!pagedir_set_page(pd, next_vpage, kpage, true))
+			NOT_REACHED();
+		frame_unlock_swappable(pd, next_vpage, kpage);
+	}
+}
+
+/* Load the swapped page VPAGE of the current process from the swap slot
+ * SWAP_ID, along with up to SWAP_IN_PAGES - 1 swapped pages directly after it
+ * in the following swap slots:
+ * 1. Get a new locked frame for VPAGE (potentially by page replacement).
+ * 2. Get frames for the following pages, but only while free frames are
+ *    available (no page replacement) and the process is within its resident
+ *    limit.
+ * 3. Read all the pages in one sequential read from the swap.
+ * 4. Set the page table entries, and unlock the frames as swappable pages.
+ *
+ * Swap slots are allocated in clusters per address space (see swap.c), so a
+ * process that was swapped out while idle has its pages brought back a run at
+ * a time rather than with a page fault each.
+ */
+static void load_swapped_pages(void *vpage, swapid_t swap_id)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	void *kpages[SWAP_IN_PAGES];
+	bool writable[SWAP_IN_PAGES];
+	size_t max_pages = pagedir_over_resident_limit(pd) ? 1 : SWAP_IN_PAGES;
+	size_t page_cnt = 1;
+
+	kpages[0] = frame_get();
+
+	/* Only this process touches its swapped pages, so they cannot change under
+	 * us.
+	 */
+	for (; page_cnt < max_pages; page_cnt++) {
+		void *next_vpage = vpage + page_cnt * PGSIZE;
+		if (!is_user_vaddr(next_vpage))
+			break;
+
+		uint32_t pte_val = pagedir_get_raw_pte(pd, next_vpage);
+		if (pte_get_type(pte_val) != SWAPPED ||
+				pte_get_swapid(pte_val) != (uint32_t)swap_id + page_cnt)
+			break;
+
+		void *kpage = frame_try_get();
+		if (!kpage)
+			break;
+		kpages[page_cnt] = kpage;
+	}
+
+	swap_load_multiple(kpages, swap_id, writable, page_cnt);
+
+	for (size_t i = 0; i < page_cnt; i++) {
+		if (!pagedir_set_page(pd, vpage + i * PGSIZE, kpages[i], writable[i]))
+			NOT_REACHED();
+		frame_unlock_swappable(pd, vpage + i * PGSIZE, kpages[i]);
+	}
+}
+#endif
+
 /* Page fault handler.  This is a skeleton that must be filled in
  * to implement virtual memory.  Some solutions to task 2 may
  * also require modifying this code.
@@ -163,89 +341,123 @@ static void page_fault(struct intr_frame *f)
 	/* Count page faults. */
 	page_fault_cnt++;
 
+	/* Determine cause of page fault. */
+	not_present = (f->error_code & PF_P) == 0;
+	write = (f->error_code & PF_W) != 0;
+	user = (f->error_code & PF_U) != 0;
+
 #ifdef VM
+	/* A process killed when memory ran out exits here (see frame.c), its
+	 * discarded pages would fault as not set.
+	 */
+	if (user && pagedir_is_dead(thread_current()->pagedir))
+		thread_exit();
 
-	/* Check for page fault on lazy zeroed, lazily loaded and mmaped pages. */
+	/* Check for page fault on lazy zeroed, mmaped and copy on write pages. */
 	switch (pte_get_type(pte_val)) {
 	/* For mmaped pages:
 	 * 1. Get the pointer to the mmap page to load (user_mmap struct).
-	 * 2. Load the mmap data from the filesystem to a new frame and set page
-	 *    table (done inside MMAP_LOAD).
+	 * 2. If writing to a copy on write page, take a copy of the page (inside
+	 *    MMAP_COPY_ON_WRITE).
+	 * 3. Otherwise load the mmap data from the filesystem to a new frame and set
+	 *    page table (done inside MMAP_LOAD).
+	 * Pages of executables read from the file bring the pages after them in
+	 * their segment in with them.
 	 */
-	case MMAPED:
-		mmap_load(pte_get_user_mmap(pte_val));
+	case MMAPED: {
+		struct user_mmap *user_mmap = pte_get_user_mmap(pte_val);
+		if (!write || !mmap_copy_on_write(user_mmap))
+			mmap_load(user_mmap);
 		return;
+	}
 
-	/* For swapped pages:
-	 * 1. Get a new locked frame (potentially by page replacement).
-	 * 2. Use the swap id from the page table entry to load from the swap.
-	 * 3. Set the page table entry to the frame was loaded to.
-	 * 4. Unlock the frame (now can be page replaced as normal).
+	/* For pages of mmaped regions, register the page (inside MMAP_REGION_PAGE),
+	 * then load it as for other mmaped pages.
 	 */
-	case SWAPPED: {
-		void *kpage = frame_get();
-		bool writable = swap_load(kpage, pte_get_swapid(pte_val));
-		if (!pagedir_set_page(thread_current()->pagedir, pg_round_down(fault_addr),
-													kpage, writable))
-			NOT_REACHED();
-		frame_unlock_swappable(thread_current()->pagedir, pg_round_down(fault_addr),
-													 kpage);
+	case REGION: {
+		struct user_mmap *user_mmap = mmap_region_page(
+						pte_get_region(pte_val), pg_round_down(fault_addr));
+		if (!user_mmap)
+			break;
+		mmap_load(user_mmap);
 		return;
 	}
 
-	/* For lazy pages:
-	 * 1. Get a new locked frame (potentially by page replacement).
-	 * 2. Load the lazy page's contents from the file system to the frame.
-	 * 3. Set the page table entry to the frame the data was loaded to.
-	 * 4. Unlock the frame (now can be page replaced as normal), and mark as a
-	 *    swappable page (evicted to swap space e.g like stack).
+	/* For swapped pages, load the page and those following it in the next swap
+	 * slots (see load_swapped_pages()), each becoming a swappable page.
 	 */
-	case LAZY: {
-		void *kpage = frame_get();
-		lazy_load_lazy(kpage, pte_get_lazy_load(pte_val));
-		if (!pagedir_set_page(thread_current()->pagedir, pg_round_down(fault_addr),
-													kpage, true))
-			NOT_REACHED();
-		frame_unlock_swappable(thread_current()->pagedir, pg_round_down(fault_addr),
-													 kpage);
+	case SWAPPED:
+		load_swapped_pages(pg_round_down(fault_addr), pte_get_swapid(pte_val));
+		return;
+
+	/* For copy on write pages not in memory, load the page from swap and set
+	 * the page table entries of all processes sharing it (inside COW_LOAD).
+	 */
+	case COW:
+		cow_load(pte_get_cow_user(pte_val));
 		return;
-	}
 
 	/* For zeroed pages:
 	 * 1. Check: access is valid:
 	 *		a. If in stack -> must be above (stack pointer - 32 bytes).
 	 *		b. Else it is from the running process's data section.
-	 * 2. Get a new locked frame (potentially by page replacement).
-	 * 3. Set the frame to all-zeros.
-	 * 4. Set the page table entry to the now zeroed frame.
-	 * 5. Unlock the frame (now can be page replaced as normal), and mark as a
-	 *    swappable page (evicted to swap space e.g like stack).
+	 * 2. If the access is a read, map the shared zero frame read-only, a frame
+	 *    is only allocated once the page is written to.
+	 * 3. Otherwise load a new zeroed frame (inside LOAD_ZEROED_PAGE), along with
+	 *    the pages below it in the stack (see LOAD_STACK_PAGES), or the rest of
+	 *    its block for writable pages outside the stack (see LOAD_ZEROED_BLOCK).
 	 */
 	case ZEROED: {
 		if (fault_addr >= (f->esp - 32) || fault_addr < STACK_BOTTOM) {
-			void *kpage = frame_get();
-			memset(kpage, 0, PGSIZE);
-			if (!pagedir_set_page(thread_current()->pagedir,
-														pg_round_down(fault_addr), kpage,
-														pte_is_zeroed_writeable(pte_val)))
-				NOT_REACHED();
-			frame_unlock_swappable(thread_current()->pagedir,
-														 pg_round_down(fault_addr), kpage);
+			if (!write) {
+				if (!pagedir_set_zero_page(thread_current()->pagedir,
+																	 pg_round_down(fault_addr),
+																	 pte_is_zeroed_writeable(pte_val)))
+					NOT_REACHED();
+			} else if (!pte_is_zeroed_writeable(pte_val)) {
+				load_zeroed_page(pg_round_down(fault_addr), false);
+			} else if (fault_addr >= STACK_BOTTOM) {
+				load_stack_pages(pg_round_down(fault_addr));
+			} else {
+				load_zeroed_block(pg_round_down(fault_addr));
+			}
 			return;
 		}
+		break;
 	}
 
+	/* For pages mapping the shared zero frame, a write to a writable page gives
+	 * it its own zeroed frame (inside LOAD_ZEROED_PAGE).
+	 *
+	 * For copy on write pages, a write to a writable page gives the process its
+	 * own copy of the frame (inside COW_WRITE).
+	 *
+	 * For copy on write pages of the executable, a write gives the process its
+	 * own copy of the page cache's frame (inside MMAP_COPY_ON_WRITE).
+	 */
+	case PAGEDIN:
+		if (write && pte_is_zero_page(pte_val) &&
+				pte_is_zero_page_writeable(pte_val)) {
+			load_zeroed_page(pg_round_down(fault_addr), true);
+			return;
+		}
+		if (write && pte_is_cow(pte_val) &&
+				cow_write(&thread_current()->cow_users, pg_round_down(fault_addr)))
+			return;
+		if (write) {
+			struct user_mmap *user_mmap = mmap_find_private(
+							&thread_current()->private_mmaps, pg_round_down(fault_addr));
+			if (user_mmap && mmap_copy_on_write(user_mmap))
+				return;
+		}
+		break;
+
 	/* All other accesses treated as normal (non-VM) page faults. */
 	default:
 		break;
 	}
 #endif
 
-	/* Determine cause of page fault. */
-	not_present = (f->error_code & PF_P) == 0;
-	write = (f->error_code & PF_W) != 0;
-	user = (f->error_code & PF_U) != 0;
-
 	/* Used to check addresses are valid in PUT_USER and GET_USER. */
 	if (!user
 #ifndef NDEBUG
@@ -3,19 +3,128 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Functions for managing the page directory.
  *
  * Where possible functions set the page table entries atomically/in one store.
  * this eliminates the possibility of mangled entries (parts of two separate
  * entry set operations).
+ *
+ * Page directories and page tables are kernel pool pages, so their state is
+ * kept in side tables indexed by page number in the kernel pool, as with the
+ * frame table. Per page directory:
+ *
+ * - Resident: the number of resident user pages it maps (its resident set
+ *   size), counted as its PTEs are set. The shared zero frame, and frames
+ *   shared copy on write, are not the process's own so are not counted.
+ * - Mlock (VM): the pages it has locked in memory (see pagedir_mlock()). Page
+ *   replacement looks pages up here, so the table is protected by MLOCK_LOCK.
+ * - Swapped (VM): the number of its own pages in swap, copy on write pages are
+ *   not counted (see pagedir_swapped_cnt()).
+ * - Dead (VM): whether its process has exited or been killed when memory runs
+ *   out (see pagedir_set_dead()).
+ * - Swap cursor (VM): where it places its next page in swap (see
+ *   pagedir_swap_cursor()).
+ *
+ * Per page table:
+ *
+ * - PT owner (VM): its page directory and the index of its PDE, so that the
+ *   frame table can record the owner of a swappable frame as a single PTE
+ *   pointer (see pagedir_pte_owner()).
+ */
+
+/* Resident set size of each page directory. */
+static size_t *resident_cnts;
+
+/* Page directories with more than RESIDENT_LIMIT resident pages are over the
+ * limit (zero for no limit), OVER_LIMIT_CNT is the number of them.
+ */
+static size_t resident_limit;
+static size_t over_limit_cnt;
+
+#ifdef VM
+/* The number of swap slots PAGEDIR_DESTROY() frees at once. */
+#define SWAP_FREE_BATCH 64
+
+/* The pages locked in memory by a page directory, sorted by address. */
+struct mlocked_pages {
+	size_t cnt;
+	void *vpages[MLOCK_LIMIT];
+};
+
+/* Locked pages of each page directory, NULL until it first locks a page. */
+static struct mlocked_pages **mlocked_pages;
+static struct lock mlock_lock;
+
+/* Swapped out pages of each page directory. */
+static size_t *swapped_cnts;
+
+/* Whether the process of each page directory has exited or been killed for
+ * memory.
  */
+static bool *dead;
+
+/* The swap slot after the last page each page directory swapped out. */
+static swapid_t *swap_cursors;
+
+/* The page directory of each page table, and the index of its PDE. */
+struct pt_owner {
+	uint32_t *pd;
+	uintptr_t pde_idx;
+};
+static struct pt_owner *pt_owners;
+#endif
 
 static uint32_t *active_pd(void);
-static void invalidate_pagedir(uint32_t *);
+static uint32_t *lookup_page(uint32_t *pd, const void *vaddr, bool create);
+static void update_pte(uint32_t *pd, uint32_t *pte, const void *vpage,
+											 uint32_t pte_val);
+static void invalidate_page(uint32_t *pd, const void *vpage);
+static inline size_t *resident_cnt(uint32_t *pd);
+static inline bool pte_is_resident(uint32_t pte);
+static void count_resident(uint32_t *pd, int change);
+#ifdef VM
+static void free_user_page(uint32_t *pd, uint32_t *pte, void *vpage);
+static inline struct mlocked_pages **mlocked(uint32_t *pd);
+static size_t mlocked_index(struct mlocked_pages *pages, const void *vpage);
+static inline size_t kpage_index(void *kpage);
+static inline bool pte_is_swapped(uint32_t pte);
+static void count_swapped(uint32_t *pd, int change);
+#endif
+
+/* Initialise resident set accounting, with the per process RESIDENT_LIMIT on
+ * resident pages (zero for no limit). Palloc and malloc must be initialised.
+ */
+void pagedir_init(size_t limit)
+{
+	resident_cnts = calloc(palloc_pool_size(false), sizeof *resident_cnts);
+	if (!resident_cnts)
+		PANIC("Unable to allocate resident set sizes.");
+	resident_limit = limit;
+
+#ifdef VM
+	mlocked_pages = calloc(palloc_pool_size(false), sizeof *mlocked_pages);
+	if (!mlocked_pages)
+		PANIC("Unable to allocate locked page tables.");
+	lock_init(&mlock_lock);
+
+	swapped_cnts = calloc(palloc_pool_size(false), sizeof *swapped_cnts);
+	dead = calloc(palloc_pool_size(false), sizeof *dead);
+	swap_cursors = calloc(palloc_pool_size(false), sizeof *swap_cursors);
+	if (!swapped_cnts || !dead || !swap_cursors)
+		PANIC("Unable to allocate swap accounting.");
+
+	pt_owners = calloc(palloc_pool_size(false), sizeof *pt_owners);
+	if (!pt_owners)
+		PANIC("Unable to allocate page table owners.");
+#endif
+}
 
 /* Creates a new page directory that has mappings for kernel virtual addresses,
  * but none for user virtual addresses. Returns the new page directory, or a
@@ -24,19 +133,32 @@ static void invalidate_pagedir(uint32_t *);
 uint32_t *pagedir_create(void)
 {
 	uint32_t *pd = palloc_get_page(0);
-	if (pd)
+	if (pd) {
 		memcpy(pd, init_page_dir, PGSIZE);
+		*resident_cnt(pd) = 0;
+#ifdef VM
+		swapped_cnts[kpage_index(pd)] = 0;
+		dead[kpage_index(pd)] = false;
+		swap_cursors[kpage_index(pd)] = SWAPID_NONE;
+#endif
+	}
 	return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages, swap entries and
- * lazy-loadings it references.
+/* Destroys page directory PD, freeing all the pages and swap entries it
+ * references.
  *
- * If using VM, all mmapings must have been unmapped prior to calling.
+ * If using VM, all mmapings and copy on write pages must have been unmapped
+ * prior to calling. The shared zero frame is never freed (see
+ * free_user_page()).
  */
 void pagedir_destroy(uint32_t *pd)
 {
 	uint32_t *pde;
+#ifdef VM
+	swapid_t swap_ids[SWAP_FREE_BATCH];
+	size_t swap_cnt = 0;
+#endif
 	if (!pd)
 		return;
 
@@ -48,57 +170,317 @@ void pagedir_destroy(uint32_t *pd)
 
 			for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++) {
 #ifdef VM
+				void *vpage = (void *)((uintptr_t)(pde - pd) << PDSHIFT |
+															 (uintptr_t)(pte - pt) << PTSHIFT);
+
+				/* Swap slots are freed in batches, taking the swap lock once for
+				 * each batch rather than once for each page.
+				 */
 				uint32_t pte_val = *pte;
 				barrier();
+				if (pte_get_type(pte_val) == SWAPPED) {
+					update_pte(pd, pte, vpage, pte_create_not_present());
+					swap_ids[swap_cnt++] = pte_get_swapid(pte_val);
+					if (swap_cnt == SWAP_FREE_BATCH) {
+						swap_free_batch(swap_ids, swap_cnt);
+						swap_cnt = 0;
+					}
+					continue;
+				}
+				free_user_page(pd, pte, vpage);
+#else
+				palloc_free_page(pte_get_page(*pte));
+#endif
+			}
+			palloc_free_page(pt);
+		}
+#ifdef VM
+	swap_free_batch(swap_ids, swap_cnt);
+#endif
+
+	/* None of the freed pages are resident any more. */
+	count_resident(pd, -(int)*resident_cnt(pd));
+#ifdef VM
+	lock_acquire(&mlock_lock);
+	free(*mlocked(pd));
+	*mlocked(pd) = NULL;
+	lock_release(&mlock_lock);
+#endif
+	palloc_free_page(pd);
+}
+
+#ifdef VM
+
+/* Frees the page VPAGE of PD, along with the frame or swap slot it references,
+ * leaving it unset. Copy on write pages are unregistered from the process's
+ * COW_USERS. VPAGE must not be mmaped.
+ */
+void pagedir_free_page(uint32_t *pd, struct hash *cow_users, void *vpage)
+{
+	uint32_t *pte = lookup_page(pd, vpage, false);
+	if (!pte)
+		return;
+
+	uint32_t pte_val = *pte;
+	barrier();
+	if (pte_get_type(pte_val) == COW || pte_is_cow(pte_val)) {
+		if (!cow_unregister(cow_users, vpage))
+			NOT_REACHED();
+		return;
+	}
+	free_user_page(pd, pte, vpage);
+}
+
+/* Frees what the PTE for VPAGE in PD references and clears it.
+ *
+ * For a page in page (currently in memory):
+ * 1. Get the frame associated with the page.
+ * 2. Attempt to frame lock the page:
+ *	a. If successful -> exclusive access, page replacement cannot
+ *                       evict/alter the frame
+ *	b. Else -> page has been evicted to swap, only the current
+ *						 process can load it back, so mutually exclusive access.
+ * 3. Use palloc to free the frame if in memory, else fall-through to
+ *    freeing a swapped page.
+ *
+ * The shared zero frame is never freed, and mmaped and copy on write pages
+ * must already have been unregistered.
+ */
+static void free_user_page(uint32_t *pd, uint32_t *pte, void *vpage)
+{
+	uint32_t pte_val = *pte;
+	barrier();
+	switch (pte_get_type(pte_val)) {
+	case PAGEDIN: {
+		/* The shared zero frame is not owned by any process. */
+		if (pte_is_zero_page(pte_val))
+			break;
+		ASSERT(!pte_is_cow(pte_val));
+		void *kpage = pte_get_page(pte_val);
+		if (frame_lock_swappable(pd, vpage, kpage)) {
+			update_pte(pd, pte, vpage, pte_create_not_present());
+			frame_free(kpage);
+			return;
+		}
+
+		/* Page replacement either swapped the page out, or discarded it as the
+		 * process has been killed for memory (see pagedir_set_dead()).
+		 */
+		pte_val = *pte;
+		barrier();
+		if (pte_get_type(pte_val) != SWAPPED)
+			break;
+	}
+	/* fall-through */
+
+	/* For a swapped out page mark the swap slot as free.*/
+	case SWAPPED:
+		update_pte(pd, pte, vpage, pte_create_not_present());
+		swap_free(pte_get_swapid(pte_val));
+		return;
+	/* For any other page, no action is required. */
+	default:
+		ASSERT(pte_get_type(pte_val) != MMAPED);
+		ASSERT(pte_get_type(pte_val) != REGION);
+		ASSERT(pte_get_type(pte_val) != COW);
+		break;
+	}
+	update_pte(pd, pte, vpage, pte_create_not_present());
+}
+
+/* Duplicates the user address space of PARENT_PD into PD for a forked process.
+ * Pages already set in PD (mmaped pages registered for the child) are skipped.
+ * COW_USERS and PARENT_COW_USERS are the bookkeeping of copy on write pages for
+ * each process. The parent process must not run while its address space is
+ * duplicated. Returns false if memory allocation fails, leaving PD partially
+ * duplicated.
+ *
+ * - Lazy-zeroed pages and shared zero frame mappings are copied.
+ * - Swappable pages (in memory or swap) become copy on write pages shared by
+ *   both processes, and copy on write pages gain the child as a user.
+ */
+bool pagedir_fork(uint32_t *pd, uint32_t *parent_pd, struct hash *cow_users,
+									struct hash *parent_cow_users)
+{
+	uint32_t *pde;
+
+	ASSERT(pd != init_page_dir && parent_pd != init_page_dir);
+	for (pde = parent_pd; pde < parent_pd + pd_no(PHYS_BASE); pde++)
+		if (*pde & PTE_P) {
+			uint32_t *pt = pde_get_pt(*pde);
+			uint32_t *pte;
+
+			/* Create the page table so every page can be set below. */
+			uintptr_t pde_vaddr = (uintptr_t)(pde - parent_pd) << PDSHIFT;
+			uint32_t *child_pt = lookup_page(pd, (void *)pde_vaddr, true);
+			if (!child_pt)
+				return false;
+
+			for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++) {
+				void *vpage = (void *)(pde_vaddr | (uintptr_t)(pte - pt) << PTSHIFT);
+				if (child_pt[pte - pt])
+					continue;
+
+				uint32_t pte_val = *pte;
+				barrier();
+				bool success = true;
 				switch (pte_get_type(pte_val)) {
-				/* For a page in page (currently in memory):
-				 * 1. Get the frame associated with the page.
-				 * 2. Attempt to frame lock the page:
-				 *	a. If successful -> exclusive access, page replacement cannot
-				 *                       evict/alter the frame
-				 *	b. Else -> page has been evicted to swap, only the current
-				 *						 process can load it back, so mutually exclusive access.
-				 * 3. Use palloc to free the frame if in memory, else fall-through to
-				 *    freeing a swapped page.
+				case ZEROED:
+					success = pagedir_set_zeroed_page(pd, vpage,
+																						pte_is_zeroed_writeable(pte_val),
+																						pte_get_zeroed_aux(pte_val));
+					break;
+				case COW:
+					success = cow_share(parent_cow_users, pd, cow_users, vpage);
+					break;
+				/* For a page in memory:
+				 * 1. If it maps the zero frame, or is copy on write already, share
+				 *    it as before.
+				 * 2. Otherwise frame lock the swappable page:
+				 *	a. If successful -> it can be made copy on write.
+				 *	b. Else -> the page has been evicted to swap, fall-through to
+				 *						 share the swapped page. If it was discarded instead,
+				 *						 the parent has been killed for memory, so the fork
+				 *						 fails.
 				 */
-				case PAGEDIN: {
-					void *kpage = pte_get_page(pte_val);
-					void *vpage = (void *)(uintptr_t)((pde - pd) * PGSIZE / sizeof *pte *
-																						PGSIZE) +
-												(pte - pt) * PGSIZE;
-					if (frame_lock_swappable(pd, vpage, kpage)) {
-						frame_free(kpage);
+				case PAGEDIN:
+					if (pte_is_zero_page(pte_val)) {
+						success = pagedir_set_zero_page(
+										pd, vpage, pte_is_zero_page_writeable(pte_val));
+						break;
+					}
+					if (pte_is_cow(pte_val)) {
+						success = cow_share(parent_cow_users, pd, cow_users, vpage);
+						break;
+					}
+					if (frame_lock_swappable(parent_pd, vpage, pte_get_page(pte_val))) {
+						success = cow_create(parent_pd, parent_cow_users, pd, cow_users,
+																 vpage, pte_get_page(pte_val), 0);
+						break;
+					}
+					pte_val = *pte;
+					barrier();
+					if (pte_get_type(pte_val) != SWAPPED) {
+						success = false;
 						break;
 					}
-				}
 				/* fall-through */
-
-				/* For a swapped out page mark the swap slot as free.*/
 				case SWAPPED:
-					swap_free(pte_get_swapid(*pte));
+					success = cow_create(parent_pd, parent_cow_users, pd, cow_users,
+															 vpage, NULL, pte_get_swapid(pte_val));
 					break;
-				/* For a lazy page, close the file and free its associated struct
-				 * (inside LAZY_FREE).
-				 */
-				case LAZY:
-					lazy_free(pte_get_lazy_load(*pte));
-					break;
-				/* For any other page, no action is required (zeroed out page table
-				 * entry).
-				 */
+				/* Mmaped pages are registered for the child before duplicating. */
 				default:
-					ASSERT(pte_get_type(pte_val) != MMAPED);
 					break;
 				}
-#else
-				palloc_free_page(pte_get_page(*pte));
-#endif
+				if (!success)
+					return false;
 			}
-			palloc_free_page(pt);
 		}
-	palloc_free_page(pd);
+	return true;
+}
+
+/* Locks VPAGE of PD in memory, so page replacement does not evict the frame
+ * mapped there (see frame.c). VPAGE must not already be locked. Returns false
+ * if PD already has MLOCK_LIMIT locked pages, or memory allocation fails.
+ */
+bool pagedir_mlock(uint32_t *pd, void *vpage)
+{
+	ASSERT(pg_ofs(vpage) == 0);
+	ASSERT(!pagedir_is_mlocked(pd, vpage));
+
+	struct mlocked_pages *pages = *mlocked(pd);
+	if (!pages) {
+		pages = malloc(sizeof *pages);
+		if (!pages)
+			return false;
+		pages->cnt = 0;
+	} else if (pages->cnt == MLOCK_LIMIT) {
+		return false;
+	}
+
+	lock_acquire(&mlock_lock);
+	size_t index = mlocked_index(pages, vpage);
+	memmove(pages->vpages + index + 1, pages->vpages + index,
+					(pages->cnt - index) * sizeof *pages->vpages);
+	pages->vpages[index] = vpage;
+	pages->cnt++;
+	*mlocked(pd) = pages;
+	lock_release(&mlock_lock);
+	return true;
+}
+
+/* Unlocks the locked pages of PD from START up to END, returning the number of
+ * pages unlocked.
+ */
+size_t pagedir_munlock(uint32_t *pd, void *start, void *end)
+{
+	struct mlocked_pages *pages = *mlocked(pd);
+	if (!pages)
+		return 0;
+
+	lock_acquire(&mlock_lock);
+	size_t first = mlocked_index(pages, start);
+	size_t last = mlocked_index(pages, end);
+	memmove(pages->vpages + first, pages->vpages + last,
+					(pages->cnt - last) * sizeof *pages->vpages);
+	pages->cnt -= last - first;
+	lock_release(&mlock_lock);
+	return last - first;
+}
+
+/* Returns true if VPAGE of PD is locked in memory. */
+bool pagedir_is_mlocked(uint32_t *pd, const void *vpage)
+{
+	bool locked = false;
+
+	/* Page directories that never locked a page are the common case, and need
+	 * no lock to check.
+	 */
+	if (!*mlocked(pd))
+		return false;
+
+	lock_acquire(&mlock_lock);
+	struct mlocked_pages *pages = *mlocked(pd);
+	if (pages) {
+		size_t index = mlocked_index(pages, vpage);
+		locked = index < pages->cnt && pages->vpages[index] == vpage;
+	}
+	lock_release(&mlock_lock);
+	return locked;
+}
+
+/* Returns the number of pages PD has locked in memory. */
+size_t pagedir_mlocked_cnt(uint32_t *pd)
+{
+	struct mlocked_pages *pages = *mlocked(pd);
+	return pages ? pages->cnt : 0;
 }
 
+/* Returns the entry for PD in the locked pages table. */
+static inline struct mlocked_pages **mlocked(uint32_t *pd)
+{
+	return &mlocked_pages[pg_no(pd) - pg_no(palloc_pool_base(false))];
+}
+
+/* Returns the index of the first of PAGES' locked pages at or above VPAGE. */
+static size_t mlocked_index(struct mlocked_pages *pages, const void *vpage)
+{
+	size_t low = 0;
+	size_t high = pages->cnt;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if ((const uint8_t *)pages->vpages[mid] < (const uint8_t *)vpage)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+#endif
+
 /* Returns the address of the page table entry for virtual
  * address VADDR in page directory PD.
  * If PD does not have a page table for VADDR, behavior depends
@@ -123,6 +505,10 @@ static uint32_t *lookup_page(uint32_t *pd, const void *vaddr, bool create)
 			if (!pt)
 				return NULL;
 
+#ifdef VM
+			pt_owners[kpage_index(pt)].pd = pd;
+			pt_owners[kpage_index(pt)].pde_idx = pd_no(vaddr);
+#endif
 			*pde = pde_create(pt);
 		} else {
 			return NULL;
@@ -154,10 +540,7 @@ bool pagedir_set_page(uint32_t *pd, void *upage, void *kpage, bool writable)
 	pte = lookup_page(pd, upage, true);
 	if (!pte)
 		return false;
-	uint32_t pte_val = pte_create_user(kpage, writable);
-	barrier();
-	*pte = pte_val;
-	invalidate_pagedir(pd);
+	update_pte(pd, pte, upage, pte_create_user(kpage, writable));
 	return true;
 }
 
@@ -194,10 +577,8 @@ void pagedir_clear_page(uint32_t *pd, void *upage)
 	ASSERT(is_user_vaddr(upage));
 
 	pte = lookup_page(pd, upage, false);
-	if (pte) {
-		*pte = pte_create_not_present();
-		invalidate_pagedir(pd);
-	}
+	if (pte)
+		update_pte(pd, pte, upage, pte_create_not_present());
 }
 
 #ifdef VM
@@ -217,9 +598,64 @@ bool pagedir_set_zeroed_page(uint32_t *pd, void *vpage, bool writable,
 	if (!pte)
 		return false;
 	uint32_t pte_val = pte_create_zeroed(writable, aux);
-	barrier();
-	*pte = pte_val;
-	invalidate_pagedir(pd);
+	update_pte(pd, pte, vpage, pte_val);
+	return true;
+}
+
+/* Sets the PTE for virtual page VPAGE in PD to map the shared zero frame
+ * read-only. If WRITABLE the page is given its own frame on the first write.
+ * Atomically sets the PTE to the correct value.
+ */
+bool pagedir_set_zero_page(uint32_t *pd, void *vpage, bool writable)
+{
+	uint32_t *pte;
+
+	ASSERT(pg_ofs(vpage) == 0);
+	ASSERT(is_user_vaddr(vpage));
+
+	pte = lookup_page(pd, vpage, true);
+	if (!pte)
+		return false;
+	uint32_t pte_val = pte_create_zero_page(frame_zero_page(), writable);
+	update_pte(pd, pte, vpage, pte_val);
+	return true;
+}
+
+/* Sets the PTE for virtual page VPAGE in PD to map the copy on write frame
+ * KPAGE read-only. Atomically sets the PTE to the correct value.
+ */
+bool pagedir_set_cow_frame(uint32_t *pd, void *vpage, void *kpage)
+{
+	uint32_t *pte;
+
+	ASSERT(pg_ofs(vpage) == 0);
+	ASSERT(pg_ofs(kpage) == 0);
+	ASSERT(is_user_vaddr(vpage));
+
+	pte = lookup_page(pd, vpage, true);
+	if (!pte)
+		return false;
+	uint32_t pte_val = pte_create_cow(kpage);
+	update_pte(pd, pte, vpage, pte_val);
+	return true;
+}
+
+/* Sets the PTE for virtual page VPAGE in PD to a copy on write page not in
+ * memory with the handle to it being COW_USER. Atomically sets the PTE to the
+ * correct value.
+ */
+bool pagedir_set_cow_page(uint32_t *pd, void *vpage, struct cow_user *cow_user)
+{
+	uint32_t *pte;
+
+	ASSERT(pg_ofs(vpage) == 0);
+	ASSERT(is_user_vaddr(vpage));
+
+	pte = lookup_page(pd, vpage, true);
+	if (!pte)
+		return false;
+	uint32_t pte_val = pte_create_cow_user(cow_user);
+	update_pte(pd, pte, vpage, pte_val);
 	return true;
 }
 
@@ -275,9 +711,7 @@ bool pagedir_set_swapped_page(uint32_t *pd, void *vpage, swapid_t swapid)
 	if (!pte)
 		return false;
 	uint32_t pte_val = pte_create_swap(swapid);
-	barrier();
-	*pte = pte_val;
-	invalidate_pagedir(pd);
+	update_pte(pd, pte, vpage, pte_val);
 	return true;
 }
 
@@ -296,17 +730,15 @@ bool pagedir_set_mmaped_page(uint32_t *pd, void *vpage,
 	if (!pte)
 		return false;
 	uint32_t pte_val = pte_create_mmaped(mmaped_page);
-	barrier();
-	*pte = pte_val;
-	invalidate_pagedir(pd);
+	update_pte(pd, pte, vpage, pte_val);
 	return true;
 }
 
-/* Sets the PTE for virtual page VPAGE in PD to lazily loaded with the handle to
- * it being LAZY_PAGE. Atomically sets the PTE to the correct value.
+/* Sets the PTE for virtual page VPAGE in PD to an unregistered page of the
+ * mmaped REGION. Atomically sets the PTE to the correct value.
  */
-bool pagedir_set_lazy_page(uint32_t *pd, void *vpage,
-													 struct lazy_load *lazy_page)
+bool pagedir_set_region_page(uint32_t *pd, void *vpage,
+														 struct mmap_region *region)
 {
 	uint32_t *pte;
 
@@ -316,10 +748,8 @@ bool pagedir_set_lazy_page(uint32_t *pd, void *vpage,
 	pte = lookup_page(pd, vpage, true);
 	if (!pte)
 		return false;
-	uint32_t pte_val = pte_create_lazy_load(lazy_page);
-	barrier();
-	*pte = pte_val;
-	invalidate_pagedir(pd);
+	uint32_t pte_val = pte_create_region(region);
+	update_pte(pd, pte, vpage, pte_val);
 	return true;
 }
 
@@ -352,6 +782,28 @@ uint32_t pagedir_get_raw_pte(uint32_t *pd, const void *vpage)
 	return *pte;
 }
 
+/* Returns the first user page at or above VPAGE that is present in PD, or NULL
+ * if there is none. Page tables that do not exist are skipped whole.
+ */
+void *pagedir_next_present(uint32_t *pd, const void *vpage)
+{
+	uintptr_t vaddr = (uintptr_t)pg_round_down(vpage);
+
+	while (vaddr < (uintptr_t)PHYS_BASE) {
+		uint32_t pde = pd[pd_no((void *)vaddr)];
+		if (!(pde & PTE_P)) {
+			vaddr = (vaddr & PDMASK) + PTSPAN;
+			continue;
+		}
+
+		uint32_t *pt = pde_get_pt(pde);
+		if (pt[pt_no((void *)vaddr)] & PTE_P)
+			return (void *)vaddr;
+		vaddr += PGSIZE;
+	}
+	return NULL;
+}
+
 #endif
 
 /* Returns if the PTE for virtual page VPAGE in PD is dirty, that is, if the
@@ -383,7 +835,7 @@ void pagedir_set_dirty(uint32_t *pd, const void *vpage, bool dirty)
 	ASSERT(pte_get_page(pte_val));
 	*pte = pte_set_dirty(pte_val, dirty);
 	if (!dirty)
-		invalidate_pagedir(pd);
+		invalidate_page(pd, vpage);
 }
 
 /* Returns if the PTE for virtual page VPAGE in PD has been accessed recently
@@ -415,7 +867,7 @@ void pagedir_set_accessed(uint32_t *pd, const void *vpage, bool accessed)
 	ASSERT(pte_get_page(pte_val));
 	*pte = pte_set_accessed(pte_val, accessed);
 	if (!accessed)
-		invalidate_pagedir(pd);
+		invalidate_page(pd, vpage);
 }
 
 /* Returns if it is possile to write to the PTE for virtual page VPAGE in PD.
@@ -448,6 +900,83 @@ void pagedir_activate(uint32_t *pd)
 	asm volatile("movl %0, %%cr3" : : "r"(vtop(pd)) : "memory");
 }
 
+/* Returns the number of resident pages mapped by PD. */
+size_t pagedir_resident_cnt(uint32_t *pd)
+{
+	return *resident_cnt(pd);
+}
+
+/* Returns true if PD maps more resident pages than the resident limit. */
+bool pagedir_over_resident_limit(uint32_t *pd)
+{
+	return resident_limit && *resident_cnt(pd) > resident_limit;
+}
+
+/* Returns true if any page directory is over the resident limit. */
+bool pagedir_any_over_resident_limit(void)
+{
+	return over_limit_cnt > 0;
+}
+
+#ifdef VM
+/* Returns the number of swapped out pages mapped by PD. Copy on write pages in
+ * swap are shared, so are not counted.
+ */
+size_t pagedir_swapped_cnt(uint32_t *pd)
+{
+	return swapped_cnts[kpage_index(pd)];
+}
+
+/* Marks the process of PD as dead, either because it has exited and PD is
+ * waiting to be destroyed, or because it has been killed as memory has run out.
+ * Page replacement discards its swappable pages rather than swapping them out,
+ * and a killed process exits at its next system call or page fault.
+ */
+void pagedir_set_dead(uint32_t *pd)
+{
+	dead[kpage_index(pd)] = true;
+}
+
+/* Returns true if the process of PD has exited or been killed because memory
+ * ran out.
+ */
+bool pagedir_is_dead(uint32_t *pd)
+{
+	return dead[kpage_index(pd)];
+}
+
+/* Returns the swap cursor of PD, the slot following the last page it swapped
+ * out, so that its pages are kept together in swap (see swap.c). Only accessed
+ * with the swap system's lock held.
+ */
+swapid_t *pagedir_swap_cursor(uint32_t *pd)
+{
+	return &swap_cursors[kpage_index(pd)];
+}
+
+/* Returns the PTE for virtual page VPAGE in PD, or NULL if there is no page
+ * table for it.
+ */
+uint32_t *pagedir_get_pte(uint32_t *pd, const void *vpage)
+{
+	ASSERT(pg_ofs(vpage) == 0);
+	return lookup_page(pd, vpage, false);
+}
+
+/* Returns the page directory containing PTE (from PAGEDIR_GET_PTE()), and sets
+ * VPAGE to the virtual page it maps.
+ */
+uint32_t *pagedir_pte_owner(const uint32_t *pte, void **vpage)
+{
+	const uint32_t *pt = pg_round_down(pte);
+	struct pt_owner *owner = &pt_owners[kpage_index((void *)pt)];
+
+	*vpage = (void *)(owner->pde_idx << PDSHIFT |
+										(uintptr_t)(pte - pt) << PTSHIFT);
+	return owner->pd;
+}
+#endif
+
 /* Returns the currently active page directory. */
 static uint32_t *active_pd(void)
 {
@@ -461,21 +990,136 @@ static uint32_t *active_pd(void)
 	return ptov(pd);
 }
 
+/* Defers the TLB invalidations of the current thread's page table changes
+ * until the matching PAGEDIR_BATCH_END(), which flushes the TLB once. Used when
+ * updating many PTEs at once (e.g. resetting accessed bits, unmapping). The
+ * caller must not access the affected user pages until the batch ends. Batches
+ * may be nested.
+ */
+void pagedir_batch_begin(void)
+{
+	thread_current()->tlb_batch_depth++;
+}
+
+/* Ends a batch started with PAGEDIR_BATCH_BEGIN(), flushing the TLB if any
+ * invalidations were deferred.
+ */
+void pagedir_batch_end(void)
+{
+	struct thread *t = thread_current();
+
+	ASSERT(t->tlb_batch_depth > 0);
+	if (--t->tlb_batch_depth == 0 && t->tlb_flush_pending) {
+		t->tlb_flush_pending = false;
+
+		/* Re-activating the page directory clears the TLB. */
+		pagedir_activate(active_pd());
+	}
+}
+
+/* Sets the PTE for virtual page VPAGE in PD to PTE_VAL. The TLB only needs
+ * invalidating if the old PTE was present, as the CPU never caches not present
+ * PTEs in the TLB.
+ */
+static void update_pte(uint32_t *pd, uint32_t *pte, const void *vpage,
+											 uint32_t pte_val)
+{
+	uint32_t old_pte_val = *pte;
+	barrier();
+	*pte = pte_val;
+	if (old_pte_val & PTE_P)
+		invalidate_page(pd, vpage);
+
+	int change = pte_is_resident(pte_val) - pte_is_resident(old_pte_val);
+	if (change)
+		count_resident(pd, change);
+#ifdef VM
+	change = pte_is_swapped(pte_val) - pte_is_swapped(old_pte_val);
+	if (change)
+		count_swapped(pd, change);
+#endif
+}
+
+/* Returns the entry for PD in the resident set size table. */
+static inline size_t *resident_cnt(uint32_t *pd)
+{
+	return &resident_cnts[pg_no(pd) - pg_no(palloc_pool_base(false))];
+}
+
+/* Returns true if PTE maps a frame counted in the resident set size. */
+static inline bool pte_is_resident(uint32_t pte)
+{
+#ifdef VM
+	if (pte_is_zero_page(pte) || pte_is_cow(pte))
+		return false;
+#endif
+	return pte & PTE_P;
+}
+
+/* Adds CHANGE to the resident set size of PD. The owning process and page
+ * replacement can both change it, so interrupts are disabled for the update.
+ */
+static void count_resident(uint32_t *pd, int change)
+{
+	enum intr_level old_level = intr_disable();
+	size_t *cnt = resident_cnt(pd);
+	bool was_over = pagedir_over_resident_limit(pd);
+
+	*cnt += change;
+	over_limit_cnt += pagedir_over_resident_limit(pd) - was_over;
+	intr_set_level(old_level);
+}
+
+#ifdef VM
+/* Returns the index of KPAGE (a page directory or page table) in the tables
+ * indexed by kernel pool page.
+ */
+static inline size_t kpage_index(void *kpage)
+{
+	return pg_no(kpage) - pg_no(palloc_pool_base(false));
+}
+
+/* Returns true if PTE is a swapped out page. */
+static inline bool pte_is_swapped(uint32_t pte)
+{
+	return (pte & (PTE_P | PTE_PTR | PTE_S)) == PTE_S;
+}
+
+/* Adds CHANGE to the number of swapped out pages of PD, with interrupts
+ * disabled as for COUNT_RESIDENT().
+ */
+static void count_swapped(uint32_t *pd, int change)
+{
+	enum intr_level old_level = intr_disable();
+	swapped_cnts[kpage_index(pd)] += change;
+	intr_set_level(old_level);
+}
+#endif
+
 /* Some page table changes can cause the CPU's translation
  * lookaside buffer (TLB) to become out-of-sync with the page
- * table.  When this happens, we have to "invalidate" the TLB by
- * re-activating it.
+ * table.  When this happens, we have to "invalidate" the TLB
+ * entry of the changed page.
  *
- * This function invalidates the TLB if PD is the active page
- * directory.  (If PD is not active then its entries are not in
- * the TLB, so there is no need to invalidate anything.)
+ * This function invalidates the TLB entry for VPAGE if PD is the
+ * active page directory.  (If PD is not active then its entries
+ * are not in the TLB, so there is no need to invalidate
+ * anything.)  Inside a batch, the invalidation is deferred to
+ * the end of the batch.
  */
-static void invalidate_pagedir(uint32_t *pd)
+static void invalidate_page(uint32_t *pd, const void *vpage)
 {
-	if (active_pd() == pd) {
-		/* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-		 * "Translation Lookaside Buffers (TLBs)".
-		 */
-		pagedir_activate(pd);
+	if (active_pd() != pd)
+		return;
+
+	struct thread *t = thread_current();
+	if (t->tlb_batch_depth > 0) {
+		t->tlb_flush_pending = true;
+		return;
 	}
+
+	/* Only invalidate the TLB entry for VPAGE.  See [IA32-v2a] "INVLPG" and
+	 * [IA32-v3a] 3.12 "Translation Lookaside Buffers (TLBs)".
+	 */
+	asm volatile("invlpg (%0)" : : "r"(vpage) : "memory");
 }
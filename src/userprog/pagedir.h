@@ -2,14 +2,17 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #ifdef VM
+#include <hash.h>
 #include "threads/pte.h"
-#include "vm/lazy.h"
+#include "vm/cow.h"
 #include "vm/mmap.h"
 #include "vm/swap.h"
 #endif
 
+void pagedir_init(size_t resident_limit);
 uint32_t *pagedir_create(void);
 void pagedir_destroy(uint32_t *pd);
 bool pagedir_set_page(uint32_t *pd, void *upage, void *kpage, bool rw);
@@ -21,20 +24,45 @@ bool pagedir_is_accessed(uint32_t *pd, const void *upage);
 void pagedir_set_accessed(uint32_t *pd, const void *upage, bool accessed);
 bool pagedir_is_writable(uint32_t *pd, const void *upage);
 void pagedir_activate(uint32_t *pd);
+void pagedir_batch_begin(void);
+void pagedir_batch_end(void);
+size_t pagedir_resident_cnt(uint32_t *pd);
+bool pagedir_over_resident_limit(uint32_t *pd);
+bool pagedir_any_over_resident_limit(void);
 
 #ifdef VM
 
+/* The maximum number of pages each page directory may lock in memory. */
+#define MLOCK_LIMIT 64
+
 bool pagedir_set_zeroed_page(uint32_t *pd, void *vpage, bool writable,
 														 uint32_t aux);
+bool pagedir_set_zero_page(uint32_t *pd, void *vpage, bool writable);
+bool pagedir_set_cow_frame(uint32_t *pd, void *vpage, void *kpage);
+bool pagedir_set_cow_page(uint32_t *pd, void *vpage, struct cow_user *cow_user);
 bool pagedir_set_swapped_page(uint32_t *pd, void *vpage, swapid_t swapid);
 bool pagedir_set_mmaped_page(uint32_t *pd, void *vpage,
 														 struct user_mmap *mmaped_page);
-bool pagedir_set_lazy_page(uint32_t *pd, void *vpage,
-													 struct lazy_load *lazy_page);
+bool pagedir_set_region_page(uint32_t *pd, void *vpage,
+														 struct mmap_region *region);
 bool pagedir_is_zeroed_writable(uint32_t *pd, const void *vpage);
 uint32_t pagedir_get_zeroed_aux(uint32_t *pd, const void *vpage);
 enum page_type pagedir_get_page_type(uint32_t *pd, const void *vpage);
 uint32_t pagedir_get_raw_pte(uint32_t *pd, const void *vpage);
+void *pagedir_next_present(uint32_t *pd, const void *vpage);
+void pagedir_free_page(uint32_t *pd, struct hash *cow_users, void *vpage);
+bool pagedir_fork(uint32_t *pd, uint32_t *parent_pd, struct hash *cow_users,
+									struct hash *parent_cow_users);
+bool pagedir_mlock(uint32_t *pd, void *vpage);
+size_t pagedir_munlock(uint32_t *pd, void *start, void *end);
+bool pagedir_is_mlocked(uint32_t *pd, const void *vpage);
+size_t pagedir_mlocked_cnt(uint32_t *pd);
+size_t pagedir_swapped_cnt(uint32_t *pd);
+void pagedir_set_dead(uint32_t *pd);
+bool pagedir_is_dead(uint32_t *pd);
+swapid_t *pagedir_swap_cursor(uint32_t *pd);
+uint32_t *pagedir_get_pte(uint32_t *pd, const void *vpage);
+uint32_t *pagedir_pte_owner(const uint32_t *pte, void **vpage);
 
 #endif
 
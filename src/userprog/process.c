@@ -23,9 +23,11 @@
 
 #ifdef VM
 
+#include "vm/frame.h"
 #include "vm/swap.h"
 #include "vm/mmap.h"
-#include "vm/lazy.h"
+#include "vm/cow.h"
+#include "vm/ksm.h"
 
 #endif
 
@@ -42,7 +44,43 @@ struct process_info {
 	struct child_manager *parent;
 };
 
+/* A page directory of an exited process, waiting for the reaper thread to
+ * destroy it.
+ */
+struct reap_request {
+	struct list_elem elem;
+	uint32_t *pd;
+};
+
+/* Page directories are destroyed by the reaper thread rather than by the
+ * exiting process, so that freeing a large address space (frame locking each
+ * page and freeing swap slots) does not hold up the exit. REAP_SEMA counts
+ * the requests in REAP_LIST.
+ */
+static struct list reap_list;
+static struct lock reap_lock;
+static struct semaphore reap_sema;
+
+#ifdef VM
+/* Setup struct for information to a forked child process */
+struct fork_info {
+	struct thread *parent_thread; /* The thread being forked. */
+	struct intr_frame *if_; /* User context of the parent at the fork. */
+	struct child_manager *parent;
+};
+#endif
+
 static thread_func start_process NO_RETURN;
+static thread_func reaper NO_RETURN;
+static void reap_pagedir(uint32_t *pd);
+static struct child_manager *child_manager_create(void);
+static tid_t child_wait_start(struct child_manager *child, tid_t tid);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool fork_files(struct thread *parent);
+static bool fork_mmapings(struct thread *parent);
+static void unmap_anon(void *start, size_t page_cnt);
+#endif
 static bool load(void (**eip)(void), char *file_name);
 static inline bool test_and_set(bool *flag);
 static inline uintptr_t word_align(uintptr_t ptr);
@@ -54,6 +92,51 @@ static void put_string_on_stack(struct process_info *child_data, int *argc,
 static bool populate_stack(struct process_info *child_data,
 													 const char *file_name_str, char *tok_save_ptr);
 
+/* Starts the reaper thread, which destroys the page directories of exited
+ * processes. Threading must have started.
+ */
+void process_init(void)
+{
+	list_init(&reap_list);
+	lock_init(&reap_lock);
+	sema_init(&reap_sema, 0);
+	if (thread_create("reaper", PRI_DEFAULT, reaper, NULL) == TID_ERROR)
+		PANIC("Unable to start the reaper thread.");
+}
+
+/* Destroys the page directories handed over by REAP_PAGEDIR(), in order. */
+static void reaper(void *aux UNUSED)
+{
+	for (;;) {
+		sema_down(&reap_sema);
+		lock_acquire(&reap_lock);
+		struct reap_request *request =
+						list_entry(list_pop_front(&reap_list), struct reap_request, elem);
+		lock_release(&reap_lock);
+
+		pagedir_destroy(request->pd);
+		free(request);
+	}
+}
+
+/* Hands PD over to the reaper thread to destroy. If the request cannot be
+ * allocated, PD is destroyed now instead.
+ */
+static void reap_pagedir(uint32_t *pd)
+{
+	struct reap_request *request = malloc(sizeof *request);
+	if (!request) {
+		pagedir_destroy(pd);
+		return;
+	}
+
+	request->pd = pd;
+	lock_acquire(&reap_lock);
+	list_push_back(&reap_list, &request->elem);
+	lock_release(&reap_lock);
+	sema_up(&reap_sema);
+}
+
 bool stack_page_setup(struct process_info *child_data)
 {
 #ifdef VM
@@ -165,14 +248,8 @@ tid_t process_execute(const char *command)
 
 	/* Setting the data that will be passed into start_process up. */
 	struct process_info child_data;
-	child_data.parent = malloc(sizeof(struct child_manager));
+	child_data.parent = child_manager_create();
 	if (child_data.parent) {
-		child_data.parent->exit_status = EXIT_STATUS_ERR;
-		child_data.parent->release = 0;
-		child_data.parent->tid = TID_ERROR;
-		sema_init(&child_data.parent->wait_sema, 0);
-		list_push_back(&thread_current()->children, &child_data.parent->elem);
-
 		/* Setting the child pointer up */
 		if (stack_page_setup(&child_data)) {
 			/* Copying the filename for tokenization. */
@@ -193,16 +270,7 @@ tid_t process_execute(const char *command)
 																			&child_data);
 						if (tid != TID_ERROR) {
 							free(command_tok);
-							sema_down(&child->wait_sema);
-
-							/* In case the child has failed to be loaded */
-							if (child->tid == TID_ERROR) {
-								tid = TID_ERROR;
-								list_remove(&child->elem);
-								if (test_and_set(&child->release))
-									free(child);
-							}
-							return tid;
+							return child_wait_start(child, tid);
 						}
 					}
 				}
@@ -220,6 +288,39 @@ tid_t process_execute(const char *command)
 	return TID_ERROR;
 }
 
+/* Creates the manager for a new child of the current process, adding it to
+ * the list of children. Returns NULL if allocation fails.
+ */
+static struct child_manager *child_manager_create(void)
+{
+	struct child_manager *child = malloc(sizeof(struct child_manager));
+	if (child) {
+		child->exit_status = EXIT_STATUS_ERR;
+		child->release = 0;
+		child->tid = TID_ERROR;
+		sema_init(&child->wait_sema, 0);
+		list_push_back(&thread_current()->children, &child->elem);
+	}
+	return child;
+}
+
+/* Waits for the newly created thread TID of CHILD to start its process.
+ * Returns TID, or TID_ERROR if the process could not be started.
+ */
+static tid_t child_wait_start(struct child_manager *child, tid_t tid)
+{
+	sema_down(&child->wait_sema);
+
+	/* In case the child has failed to be loaded */
+	if (child->tid == TID_ERROR) {
+		tid = TID_ERROR;
+		list_remove(&child->elem);
+		if (test_and_set(&child->release))
+			free(child);
+	}
+	return tid;
+}
+
 /* A thread function that loads a user process and starts it
  * running.
  */
@@ -243,11 +344,16 @@ static void start_process(void *data_ptr)
 					(char *)(data->stack_template + PGSIZE -
 									 ((uint8_t *)PHYS_BASE - (uint8_t *)file_name_user_ptr));
 
+	bool success = true;
 #ifdef VM
 	list_init(&thread_current()->exec_file_mmapings);
+	success = cow_users_init(&thread_current()->cow_users);
+	if (success && !mmap_private_init(&thread_current()->private_mmaps)) {
+		hash_destroy(&thread_current()->cow_users, NULL);
+		success = false;
+	}
 #endif
-	bool success = true;
-	if (!load(&if_.eip, file_name)) {
+	if (!success || !load(&if_.eip, file_name)) {
 #ifdef VM
 		frame_free(data->stack_template);
 #else
@@ -282,6 +388,11 @@ static void start_process(void *data_ptr)
 		success = false;
 #endif
 
+#ifdef VM
+	if (success)
+		ksm_register(thread_current());
+#endif
+
 	/* Informing the process_execute that we have set our new tid. */
 	if (success)
 		data->parent->tid = thread_current()->tid;
@@ -316,6 +427,384 @@ static void start_process(void *data_ptr)
 	NOT_REACHED();
 }
 
+#ifdef VM
+
+/* Creates a copy of the current process, running from the same point with its
+ * own copy of the address space and open files. Pages are shared copy on write
+ * between the processes. Returns the new process's thread id to the parent (0
+ * is returned to the child), or TID_ERROR if the process cannot be created.
+ */
+tid_t process_fork(void)
+{
+	struct fork_info child_data;
+	child_data.parent_thread = thread_current();
+
+	/* The user context is saved at the top of the thread's kernel stack on entry
+	 * to the syscall.
+	 */
+	child_data.if_ =
+					(struct intr_frame *)((uint8_t *)thread_current() + PGSIZE) - 1;
+	child_data.parent = child_manager_create();
+	if (!child_data.parent)
+		return TID_ERROR;
+
+	struct child_manager *child = child_data.parent;
+	tid_t tid = thread_create(thread_current()->name, PRI_DEFAULT, start_fork,
+														&child_data);
+	if (tid == TID_ERROR) {
+		list_remove(&child->elem);
+		free(child);
+		return TID_ERROR;
+	}
+	return child_wait_start(child, tid);
+}
+
+/* A thread function that duplicates the process of the parent thread in
+ * DATA_PTR and starts it running. The parent waits for the duplication to
+ * finish, so its resources can be safely shared.
+ */
+static void start_fork(void *data_ptr)
+{
+	struct fork_info *data = data_ptr;
+	struct thread *cur = thread_current();
+	struct thread *parent = data->parent_thread;
+#ifndef NDEBUG
+	cur->may_page_fault = false;
+#endif
+	/* Continue from the parent's context, returning 0 from the syscall. */
+	struct intr_frame if_ = *data->if_;
+	if_.eax = 0;
+
+	cur->parent = data->parent;
+	list_init(&cur->exec_file_mmapings);
+	cur->heap_start = parent->heap_start;
+	cur->brk = parent->brk;
+
+	/* The process's bookkeeping must all be initialised before the page
+	 * directory is set, so that PROCESS_EXIT() can free it on failure.
+	 */
+	if (vector_init(&cur->open_files)) {
+		if (vector_init(&cur->mmapings)) {
+			if (cow_users_init(&cur->cow_users)) {
+				if (mmap_private_init(&cur->private_mmaps)) {
+					cur->pagedir = pagedir_create();
+					if (!cur->pagedir)
+						mmap_private_destroy(&cur->private_mmaps);
+				}
+				if (!cur->pagedir)
+					hash_destroy(&cur->cow_users, NULL);
+			}
+			if (!cur->pagedir)
+				vector_destroy(&cur->mmapings);
+		}
+		if (!cur->pagedir)
+			vector_destroy(&cur->open_files);
+	}
+
+	/* Mmaped pages are registered first, so the page directory duplication skips
+	 * them.
+	 */
+	bool success = false;
+	if (cur->pagedir) {
+		process_activate();
+		success = fork_files(parent) && fork_mmapings(parent);
+		if (success) {
+			lock_acquire(&parent->ksm_lock);
+			success = pagedir_fork(cur->pagedir, parent->pagedir, &cur->cow_users,
+														 &parent->cow_users);
+			lock_release(&parent->ksm_lock);
+		}
+	}
+
+	/* Informing the process_fork that we have set our new tid. */
+	if (success) {
+		ksm_register(cur);
+		data->parent->tid = cur->tid;
+	}
+	sema_up(&data->parent->wait_sema); /* DATA is not usable past this point */
+
+	if (!success) {
+		if (!cur->pagedir) {
+			printf("%s: exit(%d)\n", cur->name, EXIT_STATUS_ERR);
+			sema_up(&cur->parent->wait_sema);
+			if (test_and_set(&cur->parent->release))
+				free(cur->parent);
+		}
+		thread_exit();
+	}
+
+	asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+	NOT_REACHED();
+}
+
+/* Opens each of the files open in PARENT for the current process, at the same
+ * position.
+ */
+static bool fork_files(struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	for (size_t offset = 0; offset < vector_size(&parent->open_files);
+			 offset++) {
+		struct file *open_file = vector_get(&parent->open_files, offset);
+		struct file *file = NULL;
+		if (open_file) {
+			filesys_enter();
+			file = file_reopen(open_file);
+			if (file)
+				file_seek(file, file_tell(open_file));
+			filesys_exit();
+			if (!file)
+				return false;
+		}
+		if (!vector_push_back(&cur->open_files, file)) {
+			filesys_enter();
+			file_close(file);
+			filesys_exit();
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Registers the current process as another user of each of the mmaped pages of
+ * PARENT, including the pages of its executable.
+ */
+static bool fork_mmapings(struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	for (size_t mmap_index = 0; mmap_index < vector_size(&parent->mmapings);
+			 mmap_index++) {
+		struct mmaping *parent_mmaping = vector_get(&parent->mmapings, mmap_index);
+		struct mmaping *mmaping = NULL;
+		if (parent_mmaping) {
+			mmaping = process_mmaping_create();
+			if (!mmaping)
+				return false;
+		}
+
+		/* Add the mmaping before registering, so it is unmapped on failure.
+		 * Anonymous pages are duplicated with the rest of the page directory.
+		 */
+		if (!vector_push_back(&cur->mmapings, mmaping)) {
+			free(mmaping);
+			return false;
+		}
+		if (parent_mmaping) {
+			mmaping->anon_start = parent_mmaping->anon_start;
+			mmaping->anon_page_cnt = parent_mmaping->anon_page_cnt;
+			if (parent_mmaping->region &&
+					!mmap_clone_region(parent_mmaping->region, cur->pagedir,
+														 &mmaping->region))
+				return false;
+		}
+	}
+	return mmap_clone_all(&parent->exec_file_mmapings, cur->pagedir,
+												&cur->exec_file_mmapings, &cur->private_mmaps);
+}
+
+/* Allocates an empty mmaping, returns NULL on failure. */
+struct mmaping *process_mmaping_create(void)
+{
+	struct mmaping *mmaping = malloc(sizeof(struct mmaping));
+	if (!mmaping)
+		return NULL;
+	mmaping->region = NULL;
+	mmaping->anon_start = NULL;
+	mmaping->anon_page_cnt = 0;
+	return mmaping;
+}
+
+/* Unmaps all pages of MMAPING from the current process and frees it.
+ *
+ * The dirty pages are written back first by MMAP_SYNC(), which writes runs of
+ * consecutive pages together, so unregistering each page finds it clean
+ * rather than writing it back on its own.
+ */
+void process_munmap(struct mmaping *mmaping)
+{
+	struct mmap_region *region = mmaping->region;
+
+	if (region)
+		mmap_sync(region, NULL, PHYS_BASE);
+	pagedir_batch_begin();
+	if (region) {
+		process_munlock(mmap_region_start(region), mmap_region_end(region));
+		mmap_unregister_region(region);
+	}
+	unmap_anon(mmaping->anon_start, mmaping->anon_page_cnt);
+	pagedir_batch_end();
+	free(mmaping);
+}
+
+/* Maps PAGE_CNT lazy-zeroed writable pages from START in the current process.
+ * Fails if any page is already set, or is not below the stack.
+ */
+bool process_map_anon(void *start, size_t page_cnt)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *vpage = start;
+
+	ASSERT(pg_ofs(start) == 0);
+	if (start >= STACK_BOTTOM || pg_no(STACK_BOTTOM) - pg_no(start) < page_cnt)
+		return false;
+
+	for (size_t i = 0; i < page_cnt; i++, vpage += PGSIZE)
+		if (pagedir_get_page_type(pd, vpage) != NOTSET ||
+				!pagedir_set_zeroed_page(pd, vpage, true, 0)) {
+			unmap_anon(start, i);
+			return false;
+		}
+	return true;
+}
+
+/* Frees the PAGE_CNT anonymous pages from START in the current process. */
+static void unmap_anon(void *start, size_t page_cnt)
+{
+	struct thread *cur = thread_current();
+	uint8_t *vpage = start;
+
+	process_munlock(start, vpage + page_cnt * PGSIZE);
+	lock_acquire(&cur->ksm_lock);
+	pagedir_batch_begin();
+	for (size_t i = 0; i < page_cnt; i++, vpage += PGSIZE)
+		pagedir_free_page(cur->pagedir, &cur->cow_users, vpage);
+	pagedir_batch_end();
+	lock_release(&cur->ksm_lock);
+}
+
+/* Locks the PAGE_CNT pages from START of the current process in memory (see
+ * frame.c), they are not loaded here. Pages already locked stay locked, and
+ * NEWLY_LOCKED[i] is set for each page i this call locks. Fails if any page is
+ * not set, if the process would have more than MLOCK_LIMIT locked pages, or if
+ * locking the pages would leave page replacement without a frame to evict.
+ */
+bool process_mlock(void *start, size_t page_cnt, bool *newly_locked)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *vpage = start;
+	size_t new_cnt = 0;
+
+	ASSERT(pg_ofs(start) == 0);
+	for (size_t i = 0; i < page_cnt; i++, vpage += PGSIZE) {
+		if (pagedir_get_page_type(pd, vpage) == NOTSET)
+			return false;
+		newly_locked[i] = !pagedir_is_mlocked(pd, vpage);
+		new_cnt += newly_locked[i];
+	}
+	if (pagedir_mlocked_cnt(pd) + new_cnt > MLOCK_LIMIT)
+		return false;
+
+	for (size_t i = 0; i < new_cnt; i++)
+		if (!frame_pin_reserve()) {
+			frame_pin_release(i);
+			return false;
+		}
+
+	/* Within the limit, locking a page can only fail allocating the locked pages
+	 * of PD, which is done when locking the first page.
+	 */
+	vpage = start;
+	for (size_t i = 0; i < page_cnt; i++, vpage += PGSIZE)
+		if (newly_locked[i] && !pagedir_mlock(pd, vpage)) {
+			frame_pin_release(new_cnt);
+			return false;
+		}
+	return true;
+}
+
+/* Unlocks the locked pages of the current process from START up to END. */
+void process_munlock(void *start, void *end)
+{
+	frame_pin_release(pagedir_munlock(thread_current()->pagedir, start, end));
+}
+
+/* Returns the end of the range of LENGTH bytes from START, limited to user
+ * virtual memory.
+ */
+static void *range_end(void *start, size_t length)
+{
+	uint8_t *end = (uint8_t *)start + length;
+	return end < (uint8_t *)start || end > (uint8_t *)PHYS_BASE ? PHYS_BASE : end;
+}
+
+/* Writes back the dirty mmaped file pages of the current process in the LENGTH
+ * bytes from the page aligned START.
+ */
+void process_msync(void *start, size_t length)
+{
+	struct thread *cur = thread_current();
+	void *end = range_end(start, length);
+
+	for (size_t mmap_index = 0; mmap_index < vector_size(&cur->mmapings);
+			 mmap_index++) {
+		struct mmaping *mmaping = vector_get(&cur->mmapings, mmap_index);
+		if (mmaping && mmaping->region)
+			mmap_sync(mmaping->region, start, end);
+	}
+}
+
+/* Applies ADVICE to the mmaped pages of the current process in the LENGTH bytes
+ * from the page aligned START (see MMAP_ADVISE()). For anonymous pages, only
+ * MMAP_DONTNEED has an effect, freeing the pages so they are zeroed when next
+ * accessed.
+ */
+void process_madvise(void *start, size_t length, enum mmap_advice advice)
+{
+	struct thread *cur = thread_current();
+	uint8_t *end = range_end(start, length);
+
+	for (size_t mmap_index = 0; mmap_index < vector_size(&cur->mmapings);
+			 mmap_index++) {
+		struct mmaping *mmaping = vector_get(&cur->mmapings, mmap_index);
+		if (!mmaping)
+			continue;
+		if (mmaping->region)
+			mmap_advise(mmaping->region, start, end, advice);
+		if (advice != MMAP_DONTNEED)
+			continue;
+
+		uint8_t *anon_end =
+			(uint8_t *)mmaping->anon_start + mmaping->anon_page_cnt * PGSIZE;
+		lock_acquire(&cur->ksm_lock);
+		for (uint8_t *vpage = mmaping->anon_start; vpage < anon_end;
+				 vpage += PGSIZE)
+			if (vpage >= (uint8_t *)start && vpage < end) {
+				pagedir_free_page(cur->pagedir, &cur->cow_users, vpage);
+				if (!pagedir_set_zeroed_page(cur->pagedir, vpage, true, 0))
+					NOT_REACHED();
+			}
+		lock_release(&cur->ksm_lock);
+	}
+}
+
+/* Moves the program break of the current process by INCREMENT bytes, mapping
+ * or freeing the heap pages between the old and new break. Returns the old
+ * break, or NULL if the heap would shrink below its start or overlap another
+ * mapping.
+ */
+void *process_sbrk(intptr_t increment)
+{
+	struct thread *cur = thread_current();
+	uint8_t *old_brk = cur->brk;
+	uint8_t *new_brk = old_brk + increment;
+	uint8_t *old_end = pg_round_up(old_brk);
+	uint8_t *new_end = pg_round_up(new_brk);
+
+	if (increment < 0) {
+		if (new_brk < cur->heap_start || new_brk > old_brk)
+			return NULL;
+		unmap_anon(new_end, (old_end - new_end) / PGSIZE);
+	} else if (increment > 0) {
+		if (new_brk < old_brk ||
+				!process_map_anon(old_end, (new_end - old_end) / PGSIZE))
+			return NULL;
+	}
+	cur->brk = new_brk;
+	return old_brk;
+}
+
+#endif
+
 /* Waits for thread child thread CHILD_TID to die and returns its exit status.
  * If it was terminated by the kernel (i.e. killed due to an exception),
  * returns -1. If child thread's tid is invalid or if it was not a child of the
@@ -363,8 +852,8 @@ void process_exit(void)
 			free(child);
 	}
 
-	/* Destroy the current process's page directory and its resources and
-	 * switch back to the kernel-only page directory.
+	/* Free the current process's resources and switch back to the kernel-only
+	 * page directory, leaving the page directory itself to the reaper thread.
 	 */
 	pd = cur->pagedir;
 	if (pd) {
@@ -389,25 +878,41 @@ void process_exit(void)
 		file_close(cur->exec_file);
 		filesys_exit();
 #else
-		/* Destroy all mmappings */
+		/* Stop the merging scanner from reading the pages freed below. */
+		ksm_unregister(cur);
+
+		/* Destroy all mmappings, with a single TLB flush for all the pages. */
+		pagedir_batch_begin();
 		for (size_t mmap_index = 0; mmap_index < vector_size(&cur->mmapings);
 				 mmap_index++) {
-			struct list *mmaping_list = vector_get(&cur->mmapings, mmap_index);
-			if (mmaping_list) {
-				while (!list_empty(mmaping_list))
-					mmap_unregister(mmap_list_entry(list_front(mmaping_list)));
-				free(mmaping_list);
-			}
+			struct mmaping *mmaping = vector_get(&cur->mmapings, mmap_index);
+			if (mmaping)
+				process_munmap(mmaping);
 		}
 		vector_destroy(&cur->mmapings);
 
+		/* Executable pages deny writes to their file until unregistered, and the
+		 * parent may write to the executable as soon as its wait returns.
+		 */
 		while (!list_empty(&cur->exec_file_mmapings))
 			mmap_unregister(mmap_list_entry(list_front(&cur->exec_file_mmapings)));
+		pagedir_batch_end();
+		mmap_private_destroy(&cur->private_mmaps);
 #endif
 
-		/* Stop the parent from waiting */
+		/* Stop the parent from waiting, the rest of the process's resources are
+		 * not visible to it.
+		 */
 		sema_up(&cur->parent->wait_sema);
 
+#ifdef VM
+		/* Stop sharing copy on write pages */
+		cow_users_destroy(&cur->cow_users);
+
+		/* Return the frames of pages still locked to page replacement. */
+		process_munlock(NULL, PHYS_BASE);
+#endif
+
 		/* Free the parent manager of the thread */
 		if (test_and_set(&cur->parent->release))
 			free(cur->parent);
@@ -422,7 +927,19 @@ void process_exit(void)
 		 */
 		cur->pagedir = NULL;
 		pagedir_activate(NULL);
-		pagedir_destroy(pd);
+#ifdef VM
+		/* A process killed for memory is no longer counted by kills waiting for
+		 * it to exit once its page directory is NULL, so they are woken now.
+		 */
+		if (pagedir_is_dead(pd))
+			frame_oom_exited();
+
+		/* Page replacement discards the dead process's frames rather than
+		 * writing them to swap while the reaper gets to them.
+		 */
+		pagedir_set_dead(pd);
+#endif
+		reap_pagedir(pd);
 	}
 }
 
@@ -540,6 +1057,11 @@ bool load(void (**eip)(void), char *file_name)
 	struct Elf32_Ehdr ehdr;
 	struct file *file = NULL;
 
+#ifdef VM
+	/* The heap starts after the last segment loaded. */
+	t->heap_start = NULL;
+#endif
+
 	/* Allocate and activate page directory. */
 	t->pagedir = pagedir_create();
 	if (!t->pagedir)
@@ -644,6 +1166,9 @@ bool load(void (**eip)(void), char *file_name)
 				if (!load_segment(file, file_page, (void *)mem_page, read_bytes,
 													zero_bytes, writable, true))
 					goto done;
+				uint8_t *segment_end = (uint8_t *)mem_page + read_bytes + zero_bytes;
+				if (segment_end > t->heap_start)
+					t->heap_start = segment_end;
 #else
 				if (!load_segment(file, file_page, (void *)mem_page, read_bytes,
 													zero_bytes, writable))
@@ -715,6 +1240,10 @@ bool load(void (**eip)(void), char *file_name)
 	/* Start address. */
 	*eip = (void (*)(void))ehdr.e_entry;
 
+#ifdef VM
+	t->brk = t->heap_start;
+#endif
+
 #ifdef VM
 	filesys_enter();
 	file_close(file); /* We keep the writability in mmapings */
@@ -896,8 +1425,8 @@ static bool prepare_page(uint8_t *vpage, bool writable, uint16_t read_bytes)
  *    then skip it
  *  - if the page does not need to load anything from the file, then it is
  *	  already set as lazy zeroed, so skip it
- *  - if it is writable, then load it lazily as a swappable page; otherwise,
- *    mmap it
+ *  - if it is writable, then mmap it copy on write, so it is shared through
+ *    the page cache until written to; otherwise, mmap it
  */
 static bool load_page(struct file *file, off_t ofs, uint8_t *vpage)
 {
@@ -911,14 +1440,8 @@ static bool load_page(struct file *file, off_t ofs, uint8_t *vpage)
 		return true;
 
 	if (pagedir_is_zeroed_writable(t->pagedir, vpage)) {
-		struct lazy_load *lazy = create_lazy_load(file, ofs, read_bytes);
-		if (!lazy)
-			return false;
-
-		if (!pagedir_set_lazy_page(t->pagedir, vpage, lazy))
-			NOT_REACHED(); /* Since we already registered that pte */
-
-		return true;
+		return mmap_register_private(file, ofs, read_bytes, t->pagedir, vpage,
+																 &t->exec_file_mmapings, &t->private_mmaps);
 	} else {
 		return mmap_register(file, ofs, read_bytes, false, t->pagedir, vpage,
 												 &t->exec_file_mmapings);
@@ -927,7 +1450,9 @@ static bool load_page(struct file *file, off_t ofs, uint8_t *vpage)
 #endif
 
 /* Create a minimal stack by mapping a zeroed page at the top of
- * user virtual memory.
+ * user virtual memory. With VM, the rest of the stack is lazy-zeroed, apart
+ * from the guard page at STACK_BOTTOM, which is never set so that a stack
+ * overflow faults rather than running into the pages below the stack.
  */
 static bool setup_stack(void **esp, uint16_t stack_size, uint8_t *kpage)
 {
@@ -939,7 +1464,7 @@ static bool setup_stack(void **esp, uint16_t stack_size, uint8_t *kpage)
 	*esp = PHYS_BASE - stack_size;
 #ifdef VM
 	frame_unlock_swappable(thread_current()->pagedir, next_stack_page, kpage);
-	for (next_stack_page -= PGSIZE; next_stack_page >= (uint8_t *)STACK_BOTTOM;
+	for (next_stack_page -= PGSIZE; next_stack_page > (uint8_t *)STACK_BOTTOM;
 			 next_stack_page -= PGSIZE) {
 		if (pagedir_get_page_type(thread_current()->pagedir, next_stack_page) !=
 				NOTSET)
@@ -4,8 +4,14 @@
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include <list.h>
+#include <stdint.h>
+#ifdef VM
+#include "vm/mmap.h"
+#endif
 
-/* The bottom of the lazy-zeroed stack */
+/* The bottom of the lazy-zeroed stack, the page at STACK_BOTTOM is its guard
+ * page (see setup_stack()).
+ */
 #define STACK_MAX_SIZE 0x400000
 #define STACK_BOTTOM PHYS_BASE - STACK_MAX_SIZE
 
@@ -22,7 +28,31 @@ struct child_manager {
 	tid_t tid; /* Tid of the child process */
 };
 
+#ifdef VM
+/* A mapping made by the mmap or mmap_anon system calls, kept in the process's
+ * MMAPINGS. A file mapping only uses REGION, an anonymous mapping only uses
+ * ANON_START and ANON_PAGE_CNT.
+ */
+struct mmaping {
+	struct mmap_region *region; /* The mapped file's pages, NULL if none. */
+	void *anon_start; /* First page of anonymous memory, NULL if none. */
+	size_t anon_page_cnt; /* Number of pages of anonymous memory. */
+};
+#endif
+
+void process_init(void);
 tid_t process_execute(const char *file_name);
+#ifdef VM
+tid_t process_fork(void);
+struct mmaping *process_mmaping_create(void);
+void process_munmap(struct mmaping *mmaping);
+bool process_map_anon(void *start, size_t page_cnt);
+void *process_sbrk(intptr_t increment);
+void process_msync(void *start, size_t length);
+void process_madvise(void *start, size_t length, enum mmap_advice advice);
+bool process_mlock(void *start, size_t page_cnt, bool *newly_locked);
+void process_munlock(void *start, void *end);
+#endif
 int process_wait(tid_t child_tid);
 void process_exit(void);
 void process_activate(void);
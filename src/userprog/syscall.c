@@ -1,4 +1,5 @@
 #include "userprog/syscall.h"
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include <syscall-nr.h>
@@ -16,11 +17,15 @@
 #ifdef VM
 
 #include "userprog/pagedir.h"
+#include "vm/frame.h"
 #include "vm/mmap.h"
 #include "threads/malloc.h"
 
 #define MAP_FAILED (-1)
 
+/* Largest offset or length within a file. */
+#define OFF_MAX INT32_MAX
+
 #endif
 
 #define FILE_FAILED (-1)
@@ -79,12 +84,22 @@ static sys_handle close;
 
 static sys_handle mmap;
 static sys_handle munmap;
-
-/* Helper function for failures in mmap and for destroying in munmap. */
-static void unregister_all_mmaps(struct list *user_mmaps);
+static sys_handle fork;
+static sys_handle rss;
+static sys_handle sbrk;
+static sys_handle mmap_anon;
+static sys_handle msync;
+static sys_handle madvise;
+static sys_handle mlock;
+static sys_handle munlock;
+static sys_handle mmap_range;
 
 typedef int mapid_t;
 
+static mapid_t reserve_mapid(struct vector *mmapings);
+static mapid_t map_file(unsigned fd, void *addr, off_t offset, off_t length);
+static bool mlock_load(void *vpage);
+
 #endif
 
 static void syscall_handler(struct intr_frame *);
@@ -123,6 +138,15 @@ void syscall_init(void)
 #ifdef VM
 	syscall_handlers[SYS_MMAP] = mmap;
 	syscall_handlers[SYS_MUNMAP] = munmap;
+	syscall_handlers[SYS_FORK] = fork;
+	syscall_handlers[SYS_RSS] = rss;
+	syscall_handlers[SYS_SBRK] = sbrk;
+	syscall_handlers[SYS_MMAP_ANON] = mmap_anon;
+	syscall_handlers[SYS_MSYNC] = msync;
+	syscall_handlers[SYS_MADVISE] = madvise;
+	syscall_handlers[SYS_MLOCK] = mlock;
+	syscall_handlers[SYS_MUNLOCK] = munlock;
+	syscall_handlers[SYS_MMAP_RANGE] = mmap_range;
 #endif
 
 	/* Initialize global filesystem lock */
@@ -137,6 +161,12 @@ void syscall_init(void)
 
 static void syscall_handler(struct intr_frame *f)
 {
+#ifdef VM
+	/* A process killed when memory ran out exits here (see frame.c). */
+	if (pagedir_is_dead(thread_current()->pagedir))
+		thread_exit();
+#endif
+
 	/* Get the args from the stack. */
 	if (!check_user_buffer(f->esp, sizeof(int)))
 		thread_exit();
@@ -551,94 +581,309 @@ void mmap(uint32_t *ret, const void *args)
 	GET_ARG(args, unsigned, fd);
 	GET_ARG(args, void *, addr);
 
-	/* Fail if file descriptor is invalid, or address not page aligned. */
-	if (fd < FD_START || !addr || pg_ofs(addr) != 0) {
+	RETURN(ret, map_file(fd, addr, 0, OFF_MAX));
+}
+
+/* Unmap a memory mapped file. If there is no mmap for that MMAPD_ID then
+ * terminate the process.
+ */
+void munmap(uint32_t *ret UNUSED, const void *args)
+{
+	GET_ARG(args, mapid_t, mmap_id);
+
+	struct vector *mmapings = &thread_current()->mmapings;
+	if (mmap_id >= (mapid_t)vector_size(mmapings))
+		thread_exit();
+
+	struct mmaping *mmaping = vector_get(mmapings, mmap_id);
+	if (!mmaping)
+		thread_exit();
+
+	process_munmap(mmaping);
+	vector_set(mmapings, mmap_id, NULL);
+}
+
+/* Creates a copy of the current process, sharing its pages copy on write.
+ * Returns the child's process ID to the parent and 0 to the child, or PID_ERROR
+ * if the process could not be created.
+ */
+void fork(uint32_t *ret, const void *args UNUSED)
+{
+	tid_t tid = process_fork();
+	RETURN(ret, tid == TID_ERROR ? PID_ERROR : tid);
+}
+
+/* Returns the number of pages of the process resident in memory, not counting
+ * pages mapping the shared zero frame or shared copy on write.
+ */
+void rss(uint32_t *ret, const void *args UNUSED)
+{
+	RETURN(ret, pagedir_resident_cnt(thread_current()->pagedir));
+}
+
+/* Moves the program break by INCREMENT bytes, returning the previous break,
+ * or -1 if the heap cannot be resized (see process_sbrk()). New heap pages are
+ * lazily zeroed.
+ */
+void sbrk(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, intptr_t, increment);
+
+	void *old_brk = process_sbrk(increment);
+	RETURN(ret, old_brk ? (uint32_t)old_brk : (uint32_t)-1);
+}
+
+/* Maps LENGTH bytes of lazily zeroed anonymous memory at the page aligned
+ * address ADDR, returning the mapping id for munmap.
+ *
+ * Fails if:
+ * - address is zero or not page aligned.
+ * - length is zero, or reaches past the bottom of the stack.
+ * - any page being mapped has already been set, or is in the stack.
+ */
+void mmap_anon(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, size_t, length);
+
+	/* Check the length before rounding it up to pages, which would overflow for
+	 * lengths near SIZE_MAX.
+	 */
+	if (!addr || pg_ofs(addr) != 0 || !length || addr >= STACK_BOTTOM ||
+			length > (size_t)((uint8_t *)STACK_BOTTOM - (uint8_t *)addr)) {
 		RETURN(ret, MAP_FAILED);
 		return;
 	}
 
-	/* Fail if file invalid. */
-	struct file *file_to_map = get_file(fd);
-	if (!file_to_map) {
+	struct mmaping *mmaping = process_mmaping_create();
+	if (!mmaping) {
 		RETURN(ret, MAP_FAILED);
 		return;
 	}
 
-	/* Fail if file length is zero. */
-	off_t length = file_length(file_to_map);
-	if (!length) {
+	struct vector *mmapings = &thread_current()->mmapings;
+	mapid_t map_id = reserve_mapid(mmapings);
+	size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	if (map_id == MAP_FAILED || !process_map_anon(addr, page_cnt)) {
+		free(mmaping);
 		RETURN(ret, MAP_FAILED);
 		return;
 	}
 
-	/* fail if unable to create a new list to contain the mapped pages. */
-	struct list *user_mmap_pages = malloc(sizeof(struct list));
-	if (!user_mmap_pages) {
-		RETURN(ret, MAP_FAILED);
+	mmaping->anon_start = addr;
+	mmaping->anon_page_cnt = page_cnt;
+	vector_set(mmapings, map_id, mmaping);
+	RETURN(ret, map_id);
+}
+
+/* Writes back the dirty pages of files mmaped in the LENGTH bytes from the
+ * page aligned address ADDR now, rather than at munmap or eviction. Returns
+ * false if ADDR is not page aligned.
+ */
+void msync(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, size_t, length);
+
+	if (pg_ofs(addr) != 0) {
+		RETURN(ret, false);
 		return;
 	}
-	list_init(user_mmap_pages);
+	process_msync(addr, length);
+	RETURN(ret, true);
+}
 
-	struct thread *cur = thread_current();
+/* Advises how the mmaped pages in the LENGTH bytes from the page aligned
+ * address ADDR will be used (see process_madvise()). Returns false if ADDR is
+ * not page aligned or ADVICE is unknown.
+ */
+void madvise(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, size_t, length);
+	GET_ARG(args, unsigned, advice);
 
-	mapid_t map_id = 0;
-	while (map_id < (mapid_t)vector_size(&cur->mmapings) &&
-				 vector_get(&cur->mmapings, map_id))
-		map_id++;
+	if (pg_ofs(addr) != 0 || advice > MMAP_DONTNEED) {
+		RETURN(ret, false);
+		return;
+	}
+	process_madvise(addr, length, advice);
+	RETURN(ret, true);
+}
 
-	if (map_id == (mapid_t)vector_size(&cur->mmapings) &&
-			!vector_push_back(&cur->mmapings, NULL)) {
-		free(user_mmap_pages);
-		RETURN(ret, MAP_FAILED);
+/* Locks the pages in the LENGTH bytes from the page aligned address ADDR in
+ * memory, loading them now so that later accesses never wait for swap or the
+ * file system. Returns false if the pages could not be locked (see
+ * process_mlock()).
+ */
+void mlock(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, size_t, length);
+
+	/* Check the length before rounding it up to pages, which would overflow for
+	 * lengths near SIZE_MAX.
+	 */
+	if (pg_ofs(addr) != 0 || !is_user_vaddr(addr) ||
+			length > (size_t)((uint8_t *)PHYS_BASE - (uint8_t *)addr)) {
+		RETURN(ret, false);
 		return;
 	}
 
-	/* load each page, if any page overlaps an already set page, or is  */
-	for (off_t offset = 0; offset < length; offset += PGSIZE, addr += PGSIZE) {
-		if (pagedir_get_page_type(cur->pagedir, addr) == NOTSET) {
-			uint16_t size = offset + PGSIZE > length ? length - offset : PGSIZE;
-			if (!mmap_register(file_to_map, offset, size, true, cur->pagedir, addr,
-												 user_mmap_pages)) {
-				unregister_all_mmaps(user_mmap_pages);
-				RETURN(ret, MAP_FAILED);
-				return;
+	/* Every page of the range ends up locked, so more than MLOCK_LIMIT pages
+	 * can never be.
+	 */
+	size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	bool newly_locked[MLOCK_LIMIT];
+	if (page_cnt > MLOCK_LIMIT || !process_mlock(addr, page_cnt, newly_locked)) {
+		RETURN(ret, false);
+		return;
+	}
+
+	/* On failure only the pages this call locked are unlocked, pages locked by
+	 * earlier calls stay locked.
+	 */
+	for (size_t i = 0; i < page_cnt; i++)
+		if (!mlock_load((uint8_t *)addr + i * PGSIZE)) {
+			for (size_t j = 0; j < page_cnt; j++) {
+				uint8_t *vpage = (uint8_t *)addr + j * PGSIZE;
+				if (newly_locked[j])
+					process_munlock(vpage, vpage + PGSIZE);
 			}
-		} else {
-			unregister_all_mmaps(user_mmap_pages);
-			RETURN(ret, MAP_FAILED);
+			RETURN(ret, false);
 			return;
 		}
+	RETURN(ret, true);
+}
+
+/* Unlocks the locked pages in the LENGTH bytes from the page aligned address
+ * ADDR, so they can be evicted again. Returns false if ADDR is not page
+ * aligned.
+ */
+void munlock(uint32_t *ret, const void *args)
+{
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, size_t, length);
+
+	if (pg_ofs(addr) != 0) {
+		RETURN(ret, false);
+		return;
 	}
-	vector_set(&cur->mmapings, map_id, user_mmap_pages);
-	RETURN(ret, map_id);
+	uint8_t *end = (uint8_t *)addr + length;
+	if (end < (uint8_t *)addr || end > (uint8_t *)PHYS_BASE)
+		end = PHYS_BASE;
+	process_munlock(addr, end);
+	RETURN(ret, true);
 }
 
-/* Unmap a memory mapped file. If there is no mmap for that MMAPD_ID then
- * terminate the process.
+/* Memory maps up to LENGTH bytes of the open file with file descriptor FD from
+ * the page aligned OFFSET, to pages starting at address ADDR. Only the part of
+ * the range within the file is mapped.
+ *
+ * Fails as for mmap, or if:
+ * - offset is not page aligned, or not within the file.
+ * - length is zero.
  */
-void munmap(uint32_t *ret UNUSED, const void *args)
+void mmap_range(uint32_t *ret, const void *args)
 {
-	GET_ARG(args, mapid_t, mmap_id);
+	GET_ARG(args, unsigned, fd);
+	GET_ARG(args, void *, addr);
+	GET_ARG(args, unsigned, offset);
+	GET_ARG(args, size_t, length);
 
-	struct vector *mmapings = &thread_current()->mmapings;
-	if (mmap_id >= (mapid_t)vector_size(mmapings))
-		thread_exit();
+	if (offset > OFF_MAX || pg_ofs((void *)offset) != 0 || !length) {
+		RETURN(ret, MAP_FAILED);
+		return;
+	}
+	RETURN(ret, map_file(fd, addr, offset, length > OFF_MAX ? OFF_MAX : length));
+}
 
-	struct list *user_mmap_pages = vector_get(mmapings, mmap_id);
-	if (!user_mmap_pages)
-		thread_exit();
+/* Loads the locked page VPAGE of the current process. Lazily zeroed pages are
+ * left, as loading them never needs I/O. Returns false if VPAGE cannot be
+ * accessed.
+ */
+static bool mlock_load(void *vpage)
+{
+	uint32_t *pd = thread_current()->pagedir;
+
+	/* An eviction may have chosen the frame before the page was locked, in which
+	 * case the page is loaded again once the eviction has updated the page
+	 * table entry.
+	 */
+	for (;;) {
+		if (pagedir_get_page_type(pd, vpage) == ZEROED)
+			return true;
+		if (get_user(vpage) == -1)
+			return false;
 
-	unregister_all_mmaps(user_mmap_pages);
-	vector_set(mmapings, mmap_id, NULL);
+		void *kpage = pagedir_get_page(pd, vpage);
+		if (!kpage)
+			continue;
+		frame_wait(kpage);
+		if (pagedir_get_page(pd, vpage) == kpage)
+			return true;
+	}
 }
 
-/* Unregister all user_mmaped pages from the list USER_MMAPS
- * and free the list.
+/* Maps up to LENGTH bytes of the open file FD from OFFSET at ADDR in the
+ * current process, see mmap_range. Returns the mapping id, or MAP_FAILED.
  */
-static void unregister_all_mmaps(struct list *user_mmaps)
+static mapid_t map_file(unsigned fd, void *addr, off_t offset, off_t length)
 {
-	while (!list_empty(user_mmaps))
-		mmap_unregister(mmap_list_entry(list_front(user_mmaps)));
-	free(user_mmaps);
+	/* Fail if file descriptor is invalid, or address not page aligned. */
+	if (fd < FD_START || !addr || pg_ofs(addr) != 0)
+		return MAP_FAILED;
+
+	/* Fail if file invalid. */
+	struct file *file_to_map = get_file(fd);
+	if (!file_to_map)
+		return MAP_FAILED;
+
+	/* Fail if no part of the file is mapped. */
+	off_t file_size = file_length(file_to_map);
+	if (offset >= file_size)
+		return MAP_FAILED;
+	if (length > file_size - offset)
+		length = file_size - offset;
+
+	/* fail if unable to create a new mmaping to contain the mapped pages. */
+	struct mmaping *mmaping = process_mmaping_create();
+	if (!mmaping)
+		return MAP_FAILED;
+
+	struct thread *cur = thread_current();
+
+	mapid_t map_id = reserve_mapid(&cur->mmapings);
+	if (map_id == MAP_FAILED) {
+		free(mmaping);
+		return MAP_FAILED;
+	}
+
+	/* Map all the pages as one region, failing if any page is already set. The
+	 * pages are registered as they are first used.
+	 */
+	if (!mmap_register_region(file_to_map, offset, length, cur->pagedir, addr,
+														&mmaping->region)) {
+		free(mmaping);
+		return MAP_FAILED;
+	}
+	vector_set(&cur->mmapings, map_id, mmaping);
+	return map_id;
+}
+
+/* Find the lowest free mapping id in MMAPINGS, extending it if all are in use.
+ * Returns MAP_FAILED if it could not be extended.
+ */
+static mapid_t reserve_mapid(struct vector *mmapings)
+{
+	mapid_t map_id = 0;
+	while (map_id < (mapid_t)vector_size(mmapings) &&
+				 vector_get(mmapings, map_id))
+		map_id++;
+
+	if (map_id == (mapid_t)vector_size(mmapings) &&
+			!vector_push_back(mmapings, NULL))
+		return MAP_FAILED;
+	return map_id;
 }
 #endif
@@ -0,0 +1,643 @@
+#include "vm/cow.h"
+#include <list.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/rmap.h"
+
+/* The copy on write (COW) system shares the private pages of a process with
+ * the processes forked from it, until one of them writes to the page.
+ *
+ * - Each shared page is a COW_PAGE, containing the frame (or swap slot when not
+ *   in memory) holding the page, and a reverse map of COW_USERs (see rmap.c).
+ * - Each COW_USER manages a different page table entry using the COW_PAGE, and
+ *   is also kept in its process's COW_USERS hashmap (keyed by virtual page) so
+ *   it can be found on a write fault to the page.
+ * - While the page is in memory all users map the frame read-only (see pte.h).
+ *   On a write, the writer either copies the frame to a new one, or if it is
+ *   the last user, takes the frame as its own swappable page.
+ *
+ *                      +---[cow_page]---+        +-->+---[rmap]---+
+ * +---[cow_users]--+   |      lock      |        |   |  cow_user  +--> PTE
+ * |      ...       |   | kpage/swap_id  |        |   +------------+
+ * | vpage-cow_user +-->|     users      +--------+   |  cow_user  +--> PTE
+ * |      ...       |   +----------------+            +------------+
+ * +----------------+
+ *
+ * Modifying the page table entries of the users of a COW_PAGE requires its
+ * lock. Access to the frame follows the same protocol as for mmaps: the frame
+ * is frame locked before the COW_PAGE's lock is acquired (see cow_lock_frame).
+ *
+ * Same-page merging (see ksm.c) also shares identical private pages of
+ * unrelated processes as merged COW_PAGEs, indexed by a checksum of their
+ * contents in MERGED_PAGES. A merged page is an ordinary COW_PAGE in every
+ * other respect, and leaves the index when it is freed. As KSM adds users from
+ * its own thread, the COW_USERS hashmaps are only accessed with USERS_LOCK.
+ */
+
+/* A page shared copy on write. Access synchronised through lock. */
+struct cow_page {
+	struct lock lock; /* General lock for this COW_PAGE. */
+	struct rmap users; /* Reverse map of the COW_USERs sharing the page. */
+	bool writable; /* Writability of the page once copied. */
+	void *kpage; /* Frame containing the page, NULL if in swap. */
+	swapid_t swap_id; /* Swap slot containing the page when not in memory. */
+	bool loading; /* Being read in from swap by a page fault (see COW_LOAD()). */
+	struct condition loaded; /* Signalled (with LOCK) when LOADING ends. */
+	bool merged; /* In MERGED_PAGES, shared by same-page merging. */
+	unsigned checksum; /* Checksum of the contents of a merged page. */
+	struct hash_elem merged_elem; /* Elem of MERGED_PAGES. */
+};
+
+/* Handles a process's page table entry for a copy on write page. */
+struct cow_user {
+	enum pte_pointer_type type; /* Struct type (see 'pte.h' pointer page). */
+	struct hash_elem cow_users_elem; /* Elem for the process's COW_USERS. */
+	struct rmap_elem mapping; /* Mapping in the COW_PAGE's USERS. */
+	struct cow_page *cow_page; /* The page shared. */
+	uint32_t *pd; /* Page directory of the user. */
+	void *vpage; /* User page the COW_PAGE is mapped to. */
+};
+
+/* Ensures that the pointer to the COW_USER will fit in a pte */
+_Static_assert(_Alignof(struct cow_user) >= 4,
+							 "cow_user needs to be 4 bytes aligned");
+
+/* Protects the COW_USERS hashmaps of all processes. */
+static struct lock users_lock;
+
+/* Merged pages, keyed by checksum, protected by MERGED_LOCK. */
+static struct hash merged_pages;
+static struct lock merged_lock;
+
+static struct cow_user *cow_user_create(uint32_t *pd, void *vpage,
+																				struct cow_page *cow_page);
+static struct cow_user *cow_user_lookup(struct hash *cow_users, void *vpage);
+static void cow_user_insert(struct hash *cow_users, struct cow_user *cow_user);
+static void cow_user_remove(struct hash *cow_users, struct cow_user *cow_user);
+static void *cow_lock_frame(struct cow_user *cow_user);
+static void cow_set_ptes(struct cow_page *cow_page);
+static void cow_page_free(struct cow_page *cow_page);
+static bool cow_merge_into(struct cow_page *merged, struct hash *cow_users,
+													 struct cow_user *cow_user, void *kpage);
+
+/* Access functions for the COW_USERS hash. */
+static hash_hash_func cow_user_hash_func;
+static hash_less_func cow_user_less_func;
+static hash_action_func cow_user_unregister;
+
+/* Access functions for the MERGED_PAGES hash. */
+static hash_hash_func merged_hash_func;
+static hash_less_func merged_less_func;
+
+/* Initialise the copy on write system. */
+void cow_init(void)
+{
+	lock_init(&users_lock);
+	lock_init(&merged_lock);
+	if (!hash_init(&merged_pages, merged_hash_func, merged_less_func, NULL))
+		PANIC("Unable to allocate the merged pages hashmap.");
+}
+
+/* Initialise the bookkeeping hashmap COW_USERS of a process. */
+bool cow_users_init(struct hash *cow_users)
+{
+	return hash_init(cow_users, cow_user_hash_func, cow_user_less_func, NULL);
+}
+
+/* Unregister every copy on write page in COW_USERS, clearing their page table
+ * entries, and destroy the hashmap. The process must no longer be scanned by
+ * same-page merging, so USERS_LOCK is not needed.
+ */
+void cow_users_destroy(struct hash *cow_users)
+{
+	hash_destroy(cow_users, cow_user_unregister);
+}
+
+/* Unregister the copy on write page at VPAGE in COW_USERS, clearing its page
+ * table entry. Returns false if VPAGE is not copy on write.
+ */
+bool cow_unregister(struct hash *cow_users, void *vpage)
+{
+	struct cow_user *cow_user = cow_user_lookup(cow_users, vpage);
+	if (!cow_user)
+		return false;
+	cow_user_remove(cow_users, cow_user);
+	cow_user_unregister(&cow_user->cow_users_elem, NULL);
+	return true;
+}
+
+/* Shares the private page at VPAGE in PD with the forked process with page
+ * directory CHILD_PD. Both page table entries are set to the new COW_PAGE and
+ * recorded in COW_USERS and CHILD_COW_USERS respectively.
+ *
+ * KPAGE     - The frame containing the page, which must be frame locked. Or
+ *             NULL if the page is in swap.
+ * SWAP_ID   - The swap slot containing the page if KPAGE is NULL.
+ *
+ * The page table of CHILD_PD for VPAGE must already exist. On failure KPAGE is
+ * unlocked as the swappable page it was before.
+ */
+bool cow_create(uint32_t *pd, struct hash *cow_users, uint32_t *child_pd,
+								struct hash *child_cow_users, void *vpage, void *kpage,
+								swapid_t swap_id)
+{
+	struct cow_page *cow_page = malloc(sizeof(struct cow_page));
+	struct cow_user *cow_user = cow_user_create(pd, vpage, cow_page);
+	struct cow_user *child_cow_user = cow_user_create(child_pd, vpage, cow_page);
+
+	if (!cow_page || !cow_user || !child_cow_user) {
+		free(cow_page);
+		free(cow_user);
+		free(child_cow_user);
+		if (kpage)
+			frame_unlock_swappable(pd, vpage, kpage);
+		return false;
+	}
+
+	lock_init(&cow_page->lock);
+	cow_page->loading = false;
+	cond_init(&cow_page->loaded);
+	rmap_init(&cow_page->users);
+	cow_page->kpage = kpage;
+	cow_page->swap_id = swap_id;
+	cow_page->writable = kpage ? pagedir_is_writable(pd, vpage) :
+															 swap_is_writable(swap_id);
+	cow_page->merged = false;
+
+	rmap_add(&cow_page->users, &cow_user->mapping, pd, vpage);
+	rmap_add(&cow_page->users, &child_cow_user->mapping, child_pd, vpage);
+	cow_user_insert(cow_users, cow_user);
+	cow_user_insert(child_cow_users, child_cow_user);
+
+	/* The COW_PAGE is not yet visible to any other process, and KPAGE is frame
+	 * locked, so it can be set up without acquiring its lock.
+	 */
+	cow_set_ptes(cow_page);
+	if (kpage)
+		frame_unlock_cow(cow_page, kpage);
+	return true;
+}
+
+/* Adds the forked process with page directory CHILD_PD as a user of the copy on
+ * write page at VPAGE in COW_USERS, recording it in CHILD_COW_USERS. The page
+ * table of CHILD_PD for VPAGE must already exist.
+ */
+bool cow_share(struct hash *cow_users, uint32_t *child_pd,
+							 struct hash *child_cow_users, void *vpage)
+{
+	struct cow_user *cow_user = cow_user_lookup(cow_users, vpage);
+	ASSERT(cow_user);
+
+	struct cow_page *cow_page = cow_user->cow_page;
+	struct cow_user *child_cow_user = cow_user_create(child_pd, vpage, cow_page);
+	if (!child_cow_user)
+		return false;
+
+	/* As in MMAP_REGISTER(), holding the COW_PAGE lock means the page cannot be
+	 * evicted or loaded while the new entry is set, so it can simply follow the
+	 * current state of the page.
+	 */
+	lock_acquire(&cow_page->lock);
+	rmap_add(&cow_page->users, &child_cow_user->mapping, child_pd, vpage);
+	if (cow_page->kpage) {
+		if (!pagedir_set_cow_frame(child_pd, vpage, cow_page->kpage))
+			NOT_REACHED();
+	} else {
+		if (!pagedir_set_cow_page(child_pd, vpage, child_cow_user))
+			NOT_REACHED();
+	}
+	lock_release(&cow_page->lock);
+
+	cow_user_insert(child_cow_users, child_cow_user);
+	return true;
+}
+
+/* Loads the copy on write page of COW_USER back from swap and updates all its
+ * users' page table entries.
+ *
+ * As in MMAP_LOAD(), the swap is read without the COW_PAGE lock, with LOADING
+ * set so that other users faulting on the page wait for the read instead of
+ * repeating it. The page is in swap to everyone else until the read is done.
+ */
+void cow_load(struct cow_user *cow_user)
+{
+	struct cow_page *cow_page = cow_user->cow_page;
+
+	lock_acquire(&cow_page->lock);
+	while (cow_page->loading)
+		cond_wait(&cow_page->loaded, &cow_page->lock);
+
+	/* If another user has already loaded the page, can just return. */
+	if (cow_page->kpage) {
+		lock_release(&cow_page->lock);
+		return;
+	}
+
+	/* The page is not in memory, so it cannot be chosen for eviction while the
+	 * lock is held in FRAME_GET() (same reasoning as in MMAP_LOAD()).
+	 */
+	void *kpage = frame_get();
+	cow_page->loading = true;
+	lock_release(&cow_page->lock);
+
+	swap_load(kpage, cow_page->swap_id);
+
+	lock_acquire(&cow_page->lock);
+	cow_page->kpage = kpage;
+	cow_page->loading = false;
+	cond_broadcast(&cow_page->loaded, &cow_page->lock);
+	cow_set_ptes(cow_page);
+
+	lock_release(&cow_page->lock);
+	frame_unlock_cow(cow_page, kpage);
+}
+
+/* Handles a write to the copy on write page at VPAGE of the current process,
+ * with COW_USERS its bookkeeping hashmap. The process is given its own writable
+ * copy of the page. Returns false if the page is not writable.
+ */
+bool cow_write(struct hash *cow_users, void *vpage)
+{
+	struct cow_user *cow_user = cow_user_lookup(cow_users, vpage);
+	if (!cow_user || !cow_user->cow_page->writable)
+		return false;
+
+	struct cow_page *cow_page = cow_user->cow_page;
+	uint32_t *pd = cow_user->pd;
+
+	/* The last user takes the frame, so a frame for the copy is only got once
+	 * the page is found to be shared. It is got with the COW_PAGE unlocked, so
+	 * eviction in FRAME_GET() never needs a lock held here, then the page is
+	 * checked again as users may have left (or the page been evicted) meanwhile.
+	 */
+	void *copy = NULL;
+	void *kpage;
+	while (true) {
+		kpage = cow_lock_frame(cow_user);
+
+		/* The page was evicted since the fault, it is loaded again on the next
+		 * access.
+		 */
+		if (!kpage) {
+			lock_release(&cow_page->lock);
+			if (copy)
+				frame_free(copy);
+			return true;
+		}
+
+		if (copy || rmap_is_single(&cow_page->users))
+			break;
+		lock_release(&cow_page->lock);
+		frame_unlock_cow(cow_page, kpage);
+		copy = frame_get();
+	}
+
+	rmap_remove(&cow_page->users, &cow_user->mapping);
+	cow_user_remove(cow_users, cow_user);
+
+	/* The last user takes the frame, otherwise the frame is copied. */
+	bool last_user = rmap_is_empty(&cow_page->users);
+	if (last_user) {
+		void *tmp = copy;
+		copy = kpage;
+		kpage = tmp;
+	} else {
+		memcpy(copy, kpage, PGSIZE);
+	}
+
+	if (!pagedir_set_page(pd, vpage, copy, true))
+		NOT_REACHED();
+	lock_release(&cow_page->lock);
+
+	if (last_user) {
+		if (kpage)
+			frame_free(kpage);
+		cow_page_free(cow_page);
+	} else {
+		frame_unlock_cow(cow_page, kpage);
+	}
+	frame_unlock_swappable(pd, vpage, copy);
+	free(cow_user);
+	return true;
+}
+
+/* Shares the private writable page at VPAGE in PD, with COW_USERS its
+ * process's bookkeeping hashmap, with an identical merged page. KPAGE is the
+ * frame containing the page, which must be frame locked, and CHECKSUM the
+ * checksum of its contents.
+ *
+ * If there is no merged page with CHECKSUM and CREATE is true, the page becomes
+ * the merged page for CHECKSUM for others to be merged with. Returns true if
+ * the page is now copy on write, with KPAGE unlocked as the merged page or
+ * freed. Otherwise KPAGE is unlocked as the swappable page it was before.
+ *
+ * The process's page kinds must not be changed by the process itself while
+ * merging (see ksm.c).
+ */
+bool cow_merge(uint32_t *pd, struct hash *cow_users, void *vpage, void *kpage,
+							 unsigned checksum, bool create)
+{
+	struct cow_user *cow_user = cow_user_create(pd, vpage, NULL);
+	if (!cow_user) {
+		frame_unlock_swappable(pd, vpage, kpage);
+		return false;
+	}
+
+	lock_acquire(&merged_lock);
+	struct cow_page key = { .checksum = checksum };
+	struct hash_elem *elem = hash_find(&merged_pages, &key.merged_elem);
+	if (elem) {
+		struct cow_page *merged =
+						hash_entry(elem, struct cow_page, merged_elem);
+		bool success = cow_merge_into(merged, cow_users, cow_user, kpage);
+		lock_release(&merged_lock);
+
+		if (success) {
+			frame_free(kpage);
+			return true;
+		}
+		free(cow_user);
+		frame_unlock_swappable(pd, vpage, kpage);
+		return false;
+	}
+
+	struct cow_page *cow_page = create ? malloc(sizeof(struct cow_page)) : NULL;
+	if (!cow_page) {
+		lock_release(&merged_lock);
+		free(cow_user);
+		frame_unlock_swappable(pd, vpage, kpage);
+		return false;
+	}
+
+	lock_init(&cow_page->lock);
+	cow_page->loading = false;
+	cond_init(&cow_page->loaded);
+	rmap_init(&cow_page->users);
+	cow_page->kpage = kpage;
+	cow_page->swap_id = 0;
+	cow_page->writable = true;
+	cow_page->merged = true;
+	cow_page->checksum = checksum;
+	cow_user->cow_page = cow_page;
+	rmap_add(&cow_page->users, &cow_user->mapping, pd, vpage);
+	cow_user_insert(cow_users, cow_user);
+
+	/* Only this thread uses MERGED_PAGES other than to remove pages, and KPAGE is
+	 * frame locked, so the new page can be set up without acquiring its lock.
+	 * Writes by the process until its page table entry is set go to KPAGE.
+	 */
+	hash_insert(&merged_pages, &cow_page->merged_elem);
+	lock_release(&merged_lock);
+	cow_set_ptes(cow_page);
+	frame_unlock_cow(cow_page, kpage);
+	return true;
+}
+
+/* Evict the frame KPAGE of COW_PAGE to swap, informing all page table entries
+ * using it. KPAGE must be frame locked before calling. The lock of the frame is
+ * held by the eviction, so that processes cannot lock the frame until the
+ * eviction has taken over the page. It is released (with FRAME_RELEASE())
+ * before the funtion returns.
+ */
+void cow_frame_evict(void *kpage, struct cow_page *cow_page)
+{
+	lock_acquire(&cow_page->lock);
+
+	/* Chained with the COW_PAGE lock so that any process that fails to frame lock
+	 * KPAGE (see COW_LOCK_FRAME()) will only see the page once it is in swap.
+	 */
+	frame_release(kpage);
+
+	cow_page->kpage = NULL;
+	cow_set_ptes(cow_page);
+	cow_page->swap_id = swap_store(kpage, cow_page->writable);
+
+	lock_release(&cow_page->lock);
+}
+
+/* Returns the reverse map of the users of COW_PAGE. Used by the frame system to
+ * check and reset the page table entries mapping its frame.
+ */
+struct rmap *cow_frame_rmap(struct cow_page *cow_page)
+{
+	return &cow_page->users;
+}
+
+/* Allocates a COW_USER of COW_PAGE for VPAGE in PD, returns NULL on failure. */
+static struct cow_user *cow_user_create(uint32_t *pd, void *vpage,
+																				struct cow_page *cow_page)
+{
+	struct cow_user *cow_user = malloc(sizeof(struct cow_user));
+	if (!cow_user)
+		return NULL;
+	cow_user->type = POINTER_COW;
+	cow_user->cow_page = cow_page;
+	cow_user->pd = pd;
+	cow_user->vpage = vpage;
+	return cow_user;
+}
+
+/* Find the COW_USER for VPAGE in COW_USERS, NULL if VPAGE is not copy on
+ * write.
+ */
+static struct cow_user *cow_user_lookup(struct hash *cow_users, void *vpage)
+{
+	struct cow_user key = { .vpage = vpage };
+
+	lock_acquire(&users_lock);
+	struct hash_elem *elem = hash_find(cow_users, &key.cow_users_elem);
+	lock_release(&users_lock);
+	return elem ? hash_entry(elem, struct cow_user, cow_users_elem) : NULL;
+}
+
+/* Record COW_USER in its process's COW_USERS. */
+static void cow_user_insert(struct hash *cow_users, struct cow_user *cow_user)
+{
+	lock_acquire(&users_lock);
+	hash_insert(cow_users, &cow_user->cow_users_elem);
+	lock_release(&users_lock);
+}
+
+/* Remove COW_USER from its process's COW_USERS. */
+static void cow_user_remove(struct hash *cow_users, struct cow_user *cow_user)
+{
+	lock_acquire(&users_lock);
+	hash_delete(cow_users, &cow_user->cow_users_elem);
+	lock_release(&users_lock);
+}
+
+/* Acquires the lock of COW_USER's COW_PAGE with the frame containing the page
+ * frame locked, returning the frame. Returns NULL (with the lock acquired) if
+ * the page is in swap.
+ *
+ * As in MMAP_UNREGISTER(), the frame must be frame locked before acquiring the
+ * COW_PAGE lock. If frame locking fails, COW_FRAME_EVICT() holds the COW_PAGE
+ * lock until the page is in swap. If another process has loaded the page in
+ * the mean time, try again.
+ */
+static void *cow_lock_frame(struct cow_user *cow_user)
+{
+	struct cow_page *cow_page = cow_user->cow_page;
+
+	while (true) {
+		void *kpage = pagedir_get_page(cow_user->pd, cow_user->vpage);
+		if (kpage && !frame_lock_cow(cow_page, kpage))
+			kpage = NULL;
+
+		lock_acquire(&cow_page->lock);
+		if (kpage || !cow_page->kpage) {
+			ASSERT(kpage == cow_page->kpage);
+			return kpage;
+		}
+		lock_release(&cow_page->lock);
+	}
+}
+
+/* Update every page table entry connected to COW_PAGE to map its frame, or to
+ * point to their COW_USER if it is in swap. Exclusive access to the entries is
+ * ensured by the COW_PAGE lock.
+ */
+static void cow_set_ptes(struct cow_page *cow_page)
+{
+	for (struct list_elem *elem = list_begin(&cow_page->users.mappings);
+			 elem != list_end(&cow_page->users.mappings); elem = list_next(elem)) {
+		struct cow_user *cow_user =
+						list_entry(elem, struct cow_user, mapping.elem);
+		bool success = cow_page->kpage ?
+													 pagedir_set_cow_frame(cow_user->pd, cow_user->vpage,
+																								 cow_page->kpage) :
+													 pagedir_set_cow_page(cow_user->pd, cow_user->vpage,
+																								cow_user);
+		if (!success)
+			NOT_REACHED();
+	}
+}
+
+/* Removes COW_USER from its COW_PAGE, clearing its page table entry. The last
+ * user frees the page. Used as the action when destroying COW_USERS.
+ */
+static void cow_user_unregister(struct hash_elem *elem, void *aux UNUSED)
+{
+	struct cow_user *cow_user =
+					hash_entry(elem, struct cow_user, cow_users_elem);
+	struct cow_page *cow_page = cow_user->cow_page;
+
+	void *kpage = cow_lock_frame(cow_user);
+
+	rmap_remove(&cow_page->users, &cow_user->mapping);
+	pagedir_clear_page(cow_user->pd, cow_user->vpage);
+	bool last_user = rmap_is_empty(&cow_page->users);
+
+	lock_release(&cow_page->lock);
+
+	/* Whether the frame lock succeeded determines if the page is in memory, as
+	 * no other user remains to load it back in.
+	 */
+	if (last_user) {
+		if (kpage)
+			frame_free(kpage);
+		else
+			swap_free(cow_page->swap_id);
+		cow_page_free(cow_page);
+	} else if (kpage) {
+		frame_unlock_cow(cow_page, kpage);
+	}
+	free(cow_user);
+}
+
+/* Adds COW_USER, with the frame locked private page in KPAGE, as a user of the
+ * MERGED page if their contents are identical, recording it in COW_USERS.
+ * MERGED_LOCK must be held, so that MERGED cannot be freed. Returns true if
+ * merged, in which case KPAGE is no longer used by the page.
+ */
+static bool cow_merge_into(struct cow_page *merged, struct hash *cow_users,
+													 struct cow_user *cow_user, void *kpage)
+{
+	/* Only merged pages in memory are used. As in COW_LOCK_FRAME(), the frame is
+	 * locked before the COW_PAGE, failing if the page has been evicted, or its
+	 * last user has taken or freed it.
+	 */
+	void *merged_kpage = merged->kpage;
+	if (!merged_kpage || !frame_lock_cow(merged, merged_kpage))
+		return false;
+	lock_acquire(&merged->lock);
+	ASSERT(!rmap_is_empty(&merged->users));
+
+	cow_user->cow_page = merged;
+	cow_user_insert(cow_users, cow_user);
+
+	/* Adding to the reverse map acquires its lock, so is done before comparing
+	 * and undone if the pages differ.
+	 */
+	rmap_add(&merged->users, &cow_user->mapping, cow_user->pd, cow_user->vpage);
+
+	/* The process may write to KPAGE until its page table entry is set, so the
+	 * comparison and the update are done with interrupts off. Nothing below can
+	 * sleep, as the page table of the page exists.
+	 */
+	enum intr_level old_level = intr_disable();
+	bool identical = !memcmp(kpage, merged_kpage, PGSIZE);
+	if (identical) {
+		if (!pagedir_set_cow_frame(cow_user->pd, cow_user->vpage, merged_kpage))
+			NOT_REACHED();
+	}
+	intr_set_level(old_level);
+	if (!identical)
+		rmap_remove(&merged->users, &cow_user->mapping);
+
+	lock_release(&merged->lock);
+	frame_unlock_cow(merged, merged_kpage);
+	if (!identical)
+		cow_user_remove(cow_users, cow_user);
+	return identical;
+}
+
+/* Frees COW_PAGE once it has no users, removing it from MERGED_PAGES. */
+static void cow_page_free(struct cow_page *cow_page)
+{
+	if (cow_page->merged) {
+		lock_acquire(&merged_lock);
+		hash_delete(&merged_pages, &cow_page->merged_elem);
+		lock_release(&merged_lock);
+	}
+	free(cow_page);
+}
+
+/* Hashing function for the cow_user struct. */
+static unsigned cow_user_hash_func(const struct hash_elem *cow_user_raw,
+																	 void *aux UNUSED)
+{
+	const struct cow_user *cow_user =
+					hash_entry(cow_user_raw, struct cow_user, cow_users_elem);
+	return hash_bytes(&cow_user->vpage, sizeof cow_user->vpage);
+}
+
+/* Comparison function for the cow_user struct. */
+static bool cow_user_less_func(const struct hash_elem *a_raw,
+															 const struct hash_elem *b_raw, void *aux UNUSED)
+{
+	const struct cow_user *a =
+					hash_entry(a_raw, struct cow_user, cow_users_elem);
+	const struct cow_user *b =
+					hash_entry(b_raw, struct cow_user, cow_users_elem);
+	return a->vpage < b->vpage;
+}
+
+/* Hashing function for merged pages, by the checksum of their contents. */
+static unsigned merged_hash_func(const struct hash_elem *cow_page_raw,
+																 void *aux UNUSED)
+{
+	return hash_entry(cow_page_raw, struct cow_page, merged_elem)->checksum;
+}
+
+/* Comparison function for merged pages. */
+static bool merged_less_func(const struct hash_elem *a_raw,
+														 const struct hash_elem *b_raw, void *aux UNUSED)
+{
+	return hash_entry(a_raw, struct cow_page, merged_elem)->checksum <
+				 hash_entry(b_raw, struct cow_page, merged_elem)->checksum;
+}
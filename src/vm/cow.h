@@ -0,0 +1,40 @@
+#ifndef VM_COW_H
+#define VM_COW_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "vm/swap.h"
+
+struct cow_user;
+struct cow_page;
+struct rmap;
+
+void cow_init(void);
+
+/* Bookkeeping of a process's copy on write pages. */
+bool cow_users_init(struct hash *cow_users);
+void cow_users_destroy(struct hash *cow_users);
+bool cow_unregister(struct hash *cow_users, void *vpage);
+
+/* Sharing pages with a forked process. */
+bool cow_create(uint32_t *pd, struct hash *cow_users, uint32_t *child_pd,
+								struct hash *child_cow_users, void *vpage, void *kpage,
+								swapid_t swap_id);
+bool cow_share(struct hash *cow_users, uint32_t *child_pd,
+							 struct hash *child_cow_users, void *vpage);
+
+/* Same-page merging of identical private pages. */
+bool cow_merge(uint32_t *pd, struct hash *cow_users, void *vpage, void *kpage,
+							 unsigned checksum, bool create);
+
+/* Page fault handling for copy on write pages. */
+void cow_load(struct cow_user *cow_user);
+bool cow_write(struct hash *cow_users, void *vpage);
+
+/* Access functions for copy on write pages - used in frame system. */
+void cow_frame_evict(void *kpage, struct cow_page *cow_page);
+struct rmap *cow_frame_rmap(struct cow_page *cow_page);
+
+#endif
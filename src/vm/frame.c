@@ -1,23 +1,95 @@
 #define PAL_USER_ENABLE
 
-#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "vm/frame.h"
+#include "vm/cow.h"
+#include "vm/rmap.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+
+/* The kind of owner of a frame, determines how the frame is evicted. */
+enum frame_owner {
+	OWNER_NONE = 0, /* Frame is free or locked (cannot be evicted). */
+	OWNER_SWAPPABLE, /* Evict to swap. */
+	OWNER_MMAP, /* Evict to filesys (mmap). */
+	OWNER_COW /* Evict to swap, shared by forked processes. */
+};
 
-/* Frame Table Entry*/
+/* Frame Table Entry, packed into 8 bytes so that page replacement scans touch
+ * as few cache lines as possible.
+ *
+ * The owner is a single word, a pointer to the owner tagged in its low bits
+ * with the enum frame_owner. Mmaped and copy on write frames point to their
+ * shared_mmap or cow_page, swappable frames point to the PTE mapping them (the
+ * page directory and virtual page are found from it, see pagedir_pte_owner()).
+ * Zero is OWNER_NONE.
+ *
+ * The frame's lock is a bit rather than a struct lock, threads waiting for it
+ * sleep in one of the FTE_WAIT_BUCKETS lists of waiters shared between frames,
+ * which are only touched when the lock is contended. The lock is never held
+ * across I/O: an eviction holds it until it has the owner's lock, and takes
+ * the page over before writing it out, while pages being read in are waited
+ * for on their owner (see load_page() in mmap.c and cow_load()). So waits for
+ * a frame's lock are short, and long waits are on the owners' locks, which
+ * donate priority. The lock bits and the policy state are in separate bytes,
+ * so that setting one never overwrites a concurrent change to the other.
+ */
 struct fte {
-	struct list_elem used_elem;
-	bool is_swappable; /* True=evict to swap False=evict to filesys(mmap). */
-	union { /* Pointer to owner of the frame. */
-		struct shared_mmap *shared_mmap; /* Mmaped page owns the frame. */
-		struct { /* Pagedir & virtual page own the frame. (Swappable) */
-			uint32_t *pd;
-			void *vpage;
-		};
-	};
+	uint32_t owner; /* Tagged pointer to the owner of the frame. */
+	uint8_t lock; /* Held while locking or evicting the frame (FTE_LOCKED). */
+
+	/* Page replacement policy state, reset when the frame is unlocked. */
+	uint8_t flags; /* FTE_HOT and FTE_FRESH (2q). */
+	uint16_t last_used; /* Low bits of ticks when last accessed (wsclock). */
+};
+
+_Static_assert(sizeof(struct fte) == 8, "Frame table entries must be 8 bytes");
+
+/* Bits of the owner word holding the enum frame_owner, owners are at least 4
+ * byte aligned.
+ */
+#define FTE_OWNER_MASK 0x3
+
+/* Bits of the lock byte. */
+#define FTE_LOCKED 0x1 /* The frame's lock is held. */
+#define FTE_WAITERS 0x2 /* Threads are waiting for the frame's lock. */
+
+/* Bits of the policy flags. */
+#define FTE_HOT 0x1 /* Accessed again since it was paged in (2q). */
+#define FTE_FRESH 0x2 /* Not yet seen by page replacement (2q). */
+
+/* A thread waiting for the lock of FRAME. */
+struct fte_waiter {
+	struct list_elem elem;
+	struct fte *frame;
+	struct thread *thread;
+};
+
+/* Lists of FTE_WAITERs, frames are hashed to a list by their index. */
+#define FTE_WAIT_BUCKETS 64
+static struct list fte_waiters[FTE_WAIT_BUCKETS];
+
+/* A page replacement policy, selected at boot with the "-rp" option. Page
+ * replacement moves the clock hand over the unlocked frames, and the policy
+ * chooses whether to evict each one in turn.
+ */
+struct replacement_policy {
+	const char *name;
+
+	/* Initialise FRAME's policy state as it is unlocked. */
+	void (*unlocked)(struct fte *frame);
+
+	/* Return true to evict FRAME, with the frame's lock held. PASS is the
+	 * number of full turns the clock hand has made without choosing a frame.
+	 */
+	bool (*evict)(struct fte *frame, unsigned pass);
 };
 
 /*                      FRAME TABLE:
@@ -28,52 +100,169 @@ struct fte {
  *   |                               |
  *   +--> base of user pool          +--> (kpage - base) = index in frame table.
  *
- * Frames can be: Present (being used & unlocked - in USED_QUEUE).
- *                Locked (being used & eviction prevented - not in USED_QUEUE).
+ * Frames can be: Present (being used & unlocked - has an owner).
+ *                Locked (being used & eviction prevented - OWNER_NONE).
  *                Free (not present, can be taken by palloc_get_page(PAL_USER)).
  *
  * Frame table is allocated once. By using a large array to store entries the
  * lookup time is very low at the expense of memory.
+ *
+ * Page replacement runs a clock over the frame table, skipping locked and free
+ * frames, and lets the replacement policy choose the frame to evict. Only the
+ * clock hand is protected by a global lock, locking and unlocking a frame only
+ * uses the frame's own lock.
+ *
+ * While any process is over the resident limit (see pagedir.c), the first turn
+ * of the clock only considers the swappable frames of such processes, so that
+ * one process using a lot of memory does not push out the pages of the rest.
+ * Mmaped and copy on write frames are shared, so are not trimmed this way.
+ *
+ * Frames mapped at a page some process has locked in memory (see
+ * pagedir_mlock()) are skipped by page replacement. The lock is on the virtual
+ * page rather than the frame, so it follows the page through copy on write.
+ * Each locked page takes a frame from UNLOCKED_FRAMES (see
+ * FRAME_PIN_RESERVE()), so locked pages can never leave page replacement
+ * without a frame to evict.
+ *
+ * Swappable and copy on write frames are only evicted once a swap slot has been
+ * reserved for them (see swap_reserve()). When swap is full, page replacement
+ * passes over those frames, and if OOM_PASSES turns of the clock find nothing
+ * else to evict, memory has run out. The process with the largest footprint
+ * (resident and swapped pages) is then killed, and its swappable frames are
+ * discarded by page replacement rather than swapped out, so they return to the
+ * pool straight away. Frames of exited processes whose page directories are
+ * waiting for the reaper (see process.c) are discarded in the same way.
  */
 static struct fte *ftes;
+static size_t frame_cnt;
 
 /* Base of the user pool, used to map kpages to entries in FTES table. */
 static uint8_t *user_base;
 
-/* Lock to ensure mutually-exclusive access to the used_queue. */
-struct lock used_queue_lock;
+/* Lock to ensure mutually-exclusive access to the CLOCK_HAND. */
+struct lock clock_lock;
+
+/* Index of the next frame to consider for page replacement. */
+static size_t clock_hand;
 
 /* Passing a down with this semaphore ensures that there is at least one
- * frame that is not locked - (free in the palloc system or unlocked in the
- * USED_QUEUE).
+ * frame that is not locked - (free in the palloc system or unlocked).
  */
 struct semaphore unlocked_frames;
 
-/* Queue of all currently non-page locked frames. */
-struct list used_queue;
+/* A single frame of zeros, mapped read-only by every lazy-zeroed page that has
+ * only been read from. Allocated from the kernel pool so it is never evicted.
+ */
+static void *zero_frame;
+
+/* Held while choosing a process to kill for memory, and by kills waiting on
+ * OOM_EXITED for an already killed process to exit.
+ */
+static struct lock oom_lock;
+static struct condition oom_exited;
+
+static void clock_unlocked(struct fte *frame);
+static bool clock_evict(struct fte *frame, unsigned pass);
+static void wsclock_unlocked(struct fte *frame);
+static bool wsclock_evict(struct fte *frame, unsigned pass);
+static void two_queue_unlocked(struct fte *frame);
+static bool two_queue_evict(struct fte *frame, unsigned pass);
+
+/* The available page replacement policies, the first is the default. */
+static const struct replacement_policy policies[] = {
+	{ "clock", clock_unlocked, clock_evict },
+	{ "wsclock", wsclock_unlocked, wsclock_evict },
+	{ "2q", two_queue_unlocked, two_queue_evict },
+};
+
+/* The page replacement policy in use. */
+static const struct replacement_policy *policy;
+
+/* Frames not accessed for WSCLOCK_TAU timer ticks have left the working set
+ * of their process, and are evicted by the wsclock policy.
+ */
+#define WSCLOCK_TAU (TIMER_FREQ / 10)
+
+/* Turns of the clock without finding a frame, while swap is full, before a
+ * process is killed for memory.
+ */
+#define OOM_PASSES 3
+
+/* The process with the largest footprint found by OOM_CONSIDER(). */
+struct oom_search {
+	struct thread *victim;
+	size_t footprint;
+	size_t killed_cnt; /* Processes killed earlier that have yet to exit. */
+};
 
 static inline struct fte *kpage_to_fte(void *kpage);
 static inline void *fte_to_kpage(struct fte *fte);
+static inline enum frame_owner fte_owner(const struct fte *entry);
+static inline void *fte_owner_ptr(const struct fte *entry);
+static inline uint32_t *fte_pd(const struct fte *entry, void **vpage);
+static inline struct rmap *fte_rmap(const struct fte *entry);
+static inline uint32_t fte_owner_word(enum frame_owner owner, const void *ptr);
+static void fte_lock(struct fte *entry);
+static bool fte_try_lock(struct fte *entry);
+static void fte_unlock(struct fte *entry);
 
 static inline bool frame_was_accessed(struct fte *entry);
 static inline void frame_reset_accessed(struct fte *entry);
+static inline bool frame_over_resident_limit(struct fte *entry);
+static inline bool frame_is_mlocked(struct fte *entry);
+static inline bool frame_is_discardable(struct fte *entry);
+static inline bool frame_needs_swap(struct fte *entry);
 static void frame_reset(struct fte *entry);
+static void *frame_evict(void);
+static void frame_oom_kill(void);
+static void oom_consider(struct thread *t, void *aux);
 
-/* Initialise the frame system. Palloc must be initialised. */
-void frame_init(void)
+/* Initialise the frame system, using the page replacement policy named
+ * POLICY_NAME (or the default if NULL). Palloc must be initialised.
+ */
+void frame_init(const char *policy_name)
 {
+	/* Choose the page replacement policy. */
+	policy = &policies[0];
+	if (policy_name) {
+		size_t i;
+
+		for (i = 0; i < sizeof policies / sizeof *policies; i++)
+			if (!strcmp(policies[i].name, policy_name))
+				break;
+		if (i == sizeof policies / sizeof *policies)
+			PANIC("unknown page replacement policy \"%s\"", policy_name);
+		policy = &policies[i];
+	}
+	printf("Page replacement policy: %s.\n", policy->name);
+
 	/* Allocate memory for frame table entries */
 	user_base = palloc_pool_base(true);
 	size_t user_pool_size = palloc_pool_size(true);
-	ftes = malloc(user_pool_size * sizeof(struct fte));
+	ftes = calloc(user_pool_size, sizeof(struct fte));
 
 	if (!ftes)
 		PANIC("Unable to allocate space from user pool frame table.");
 
-	/* Initialise queue system. */
-	lock_init(&used_queue_lock);
+	frame_cnt = user_pool_size;
+	for (size_t i = 0; i < FTE_WAIT_BUCKETS; i++)
+		list_init(&fte_waiters[i]);
+
+	/* Initialise page replacement. */
+	lock_init(&clock_lock);
+	clock_hand = 0;
 	sema_init(&unlocked_frames, user_pool_size);
-	list_init(&used_queue);
+	lock_init(&oom_lock);
+	cond_init(&oom_exited);
+
+	/* Allocate the shared zero frame. */
+	zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+}
+
+/* Get the shared read-only frame of zeros. */
+void *frame_zero_page(void)
+{
+	return zero_frame;
 }
 
 /* Get a free frame from palloc, if all frames are used, evict a frame. */
@@ -84,53 +273,253 @@ void *frame_get(void)
 
 	if (new_page)
 		return new_page;
+	return frame_evict();
+}
+
+/* Get a free frame from palloc without page replacement, returns NULL if there
+ * are no free frames.
+ */
+void *frame_try_get(void)
+{
+	if (!sema_try_down(&unlocked_frames))
+		return NULL;
+
+	void *new_page = palloc_get_page(PAL_USER);
+	if (!new_page)
+		sema_up(&unlocked_frames);
+	return new_page;
+}
 
+/* Get a locked frame of zeros. Free frames already zeroed by the idle thread
+ * are used first, an evicted frame must be zeroed here.
+ */
+void *frame_get_zeroed(void)
+{
+	sema_down(&unlocked_frames);
+	void *new_page = palloc_get_page(PAL_USER | PAL_ZERO);
+
+	if (new_page)
+		return new_page;
+
+	new_page = frame_evict();
+	memset(new_page, 0, PGSIZE);
+	return new_page;
+}
+
+/* Get a free frame of zeros without page replacement, returns NULL if there are
+ * no free frames.
+ */
+void *frame_try_get_zeroed(void)
+{
+	if (!sema_try_down(&unlocked_frames))
+		return NULL;
+
+	void *new_page = palloc_get_page(PAL_USER | PAL_ZERO);
+	if (!new_page)
+		sema_up(&unlocked_frames);
+	return new_page;
+}
+
+/* Evict a frame and return it locked, the caller must have already taken a
+ * frame from UNLOCKED_FRAMES.
+ */
+static void *frame_evict(void)
+{
 	/* If there are no free frames available, must evict a page & replace.
-	 * Run second chance algorithm, using USED_QUEUE as a circular queue.
-	 * The frame_was_accessed() and frame_reset_accessed() functions check for
-	 * access of mmaps (requires accessing multiple page directories),
-	 * swappable frames.
+	 * Run the clock over the frame table as a circular queue, asking the policy
+	 * about each frame. The frame_was_accessed() and frame_reset_accessed()
+	 * functions check for access of mmaps (requires accessing multiple page
+	 * directories), swappable frames.
+	 *
+	 * The frame's lock is held from choosing it until the owner's lock has been
+	 * acquired in the eviction (which then calls FRAME_RELEASE()), so a process
+	 * failing to lock the frame knows that it has been (or is being) evicted.
 	 */
-	lock_acquire(&used_queue_lock);
 	struct fte *evictee;
-	void *page;
-	struct list_elem *evictee_elem = list_pop_front(&used_queue);
-	evictee = list_entry(evictee_elem, struct fte, used_elem);
-	page = fte_to_kpage(evictee);
-
-	while (frame_was_accessed(evictee)) {
-		frame_reset_accessed(evictee);
-		list_push_back(&used_queue, evictee_elem);
-
-		evictee_elem = list_pop_front(&used_queue);
-		evictee = list_entry(evictee_elem, struct fte, used_elem);
-		page = fte_to_kpage(evictee);
+	size_t skipped = 0;
+	size_t examined = 0;
+	unsigned pass = 0;
+	bool swap_full = false;
+	bool discard;
+
+	lock_acquire(&clock_lock);
+	bool trim = pagedir_any_over_resident_limit();
+
+	/* The accessed bit resets only need one TLB flush at the end. */
+	pagedir_batch_begin();
+	for (;;) {
+		evictee = &ftes[clock_hand];
+		clock_hand = (clock_hand + 1) % frame_cnt;
+		if (++examined % frame_cnt == 0)
+			pass++;
+
+		/* Out of memory, kill a process and start again. */
+		if (swap_full && pass > OOM_PASSES) {
+			pagedir_batch_end();
+			lock_release(&clock_lock);
+
+			frame_oom_kill();
+
+			lock_acquire(&clock_lock);
+			trim = pagedir_any_over_resident_limit();
+			pagedir_batch_begin();
+			skipped = examined = pass = 0;
+			swap_full = false;
+			continue;
+		}
+
+		/* Skip locked and free frames, and frames being locked right now. */
+		if (evictee->owner == OWNER_NONE || !fte_try_lock(evictee)) {
+			/* The frame reserved from UNLOCKED_FRAMES may have been freed since, in
+			 * which case no frame can be evicted, so try to take it from palloc.
+			 */
+			if (++skipped > 2 * frame_cnt) {
+				void *new_page = palloc_get_page(PAL_USER);
+				if (new_page) {
+					pagedir_batch_end();
+					lock_release(&clock_lock);
+					return new_page;
+				}
+				skipped = 0;
+			}
+			continue;
+		}
+
+		/* Frames of a process killed for memory, or that has exited, are taken
+		 * first.
+		 */
+		discard = frame_is_discardable(evictee);
+		if (discard)
+			break;
+
+		if (evictee->owner != OWNER_NONE &&
+				(!trim || pass > 0 || frame_over_resident_limit(evictee)) &&
+				!frame_is_mlocked(evictee) && policy->evict(evictee, pass)) {
+			if (!frame_needs_swap(evictee) || swap_reserve())
+				break;
+			swap_full = true;
+		}
+		fte_unlock(evictee);
 	}
+	pagedir_batch_end();
+
+	/* The chosen frame is kept by its lock, so other evictions can continue. */
+	lock_release(&clock_lock);
+
+	void *page = fte_to_kpage(evictee);
 
 	/* Evict the frame, and reset ownership. */
-	if (evictee->is_swappable) {
-		uint32_t *pd = evictee->pd;
-		void *vpage = evictee->vpage;
+	switch (fte_owner(evictee)) {
+	case OWNER_SWAPPABLE: {
+		void *vpage;
+		uint32_t *pd = fte_pd(evictee, &vpage);
 
 		frame_reset(evictee);
 
-		swap_page_evict(page, pd, vpage, &used_queue_lock);
-		ASSERT(!lock_held_by_current_thread(&used_queue_lock));
-	} else {
-		void *shared_mmap = evictee->shared_mmap;
+		/* The dead process never uses the page again, so it is not saved. */
+		if (discard) {
+			pagedir_clear_page(pd, vpage);
+			fte_unlock(evictee);
+		} else
+			swap_page_evict(page, pd, vpage);
+		break;
+	}
+	case OWNER_MMAP: {
+		struct shared_mmap *shared_mmap = fte_owner_ptr(evictee);
 
 		frame_reset(evictee);
 
-		mmap_frame_evict(page, shared_mmap, &used_queue_lock);
+		mmap_frame_evict(page, shared_mmap);
+		break;
+	}
+	case OWNER_COW: {
+		struct cow_page *cow_page = fte_owner_ptr(evictee);
+
+		frame_reset(evictee);
+
+		cow_frame_evict(page, cow_page);
+		break;
+	}
+	default:
+		NOT_REACHED();
 	}
 
 	/* Return the locked frame (cannot be evicted). */
 	return page;
 }
 
+/* Kill the process with the largest footprint, as memory has run out. The
+ * process exits at its next system call or page fault, but its swappable
+ * frames can be discarded by page replacement straight away.
+ *
+ * If every process has been killed already, waits for one of them to exit
+ * (see frame_oom_exited()) and free its mmaped, copy on write and locked
+ * frames instead. A killed process does not wait, as it may be the one the
+ * others are waiting for, and only panics if no other process can free memory.
+ */
+static void frame_oom_kill(void)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	struct oom_search search = { NULL, 0, 0 };
+
+	lock_acquire(&oom_lock);
+	enum intr_level old_level = intr_disable();
+	thread_foreach(oom_consider, &search);
+	if (search.victim)
+		pagedir_set_dead(search.victim->pagedir);
+	intr_set_level(old_level);
+
+	if (!search.victim && !(pd && pagedir_is_dead(pd))) {
+		if (!search.killed_cnt)
+			PANIC("Out of memory.");
+		cond_wait(&oom_exited, &oom_lock);
+		lock_release(&oom_lock);
+		return;
+	}
+	lock_release(&oom_lock);
+
+	/* Give the victim a chance to exit. */
+	thread_yield();
+}
+
+/* Wakes the kills waiting for a process killed for memory to exit, called by
+ * the killed process once it has freed its memory and left its page directory
+ * for the reaper.
+ */
+void frame_oom_exited(void)
+{
+	lock_acquire(&oom_lock);
+	cond_broadcast(&oom_exited, &oom_lock);
+	lock_release(&oom_lock);
+}
+
+/* Consider thread T as the process to kill for memory, AUX is the OOM_SEARCH.
+ * Processes already killed are skipped and counted, their frames are being
+ * discarded.
+ */
+static void oom_consider(struct thread *t, void *aux)
+{
+	struct oom_search *search = aux;
+	uint32_t *pd = t->pagedir;
+
+	if (!pd)
+		return;
+	if (pagedir_is_dead(pd)) {
+		search->killed_cnt++;
+		return;
+	}
+
+	size_t footprint = pagedir_resident_cnt(pd) + pagedir_swapped_cnt(pd);
+	if (footprint > search->footprint) {
+		search->victim = t;
+		search->footprint = footprint;
+	}
+}
+
 /* FRAME LOCKING:
  * frame identifier: *kpage (from the frame table entry)
- * frame owner:      shared_mmap for mmaps | pagedir for swappable pages
+ * frame owner:      shared_mmap for mmaps | PTE for swappable pages |
+ *                   cow_page for copy on write pages
  *
  *   KPAGE + OWNER
  *         |
@@ -153,28 +542,28 @@ void *frame_get(void)
  * (only the process owning the frame can access it).
  *
  * In the case of an mmap, only processes sharing the frame can access it, and
- * do so through synchronisation provided in the mmaping system.
+ * do so through synchronisation provided in the mmaping system. Copy on write
+ * frames are synchronised in the same way by the cow system.
  */
 
 /* Lock a frame containing an mmaped page. */
 bool frame_lock_mmaped(struct shared_mmap *shared_mmap, void *kpage)
 {
-	/* We cannot optimize this SEMA_DOWN() away here because, by the time this
-	 * function exits, it is crucial that the USED_QUEUE_LOCK has been released
-	 * during the potential eviction in FRAME_GET() and that acquiring the
-	 * lock for the specific page that we are evicting there will corelate the
-	 * state that this function has returned and whether the page we were trying
-	 * to lock is paged-in or paged-out.
+	/* By the time this function exits, it is crucial that the frame's lock has
+	 * been released during the potential eviction in FRAME_GET() and that
+	 * acquiring the lock for the specific page that we are evicting there will
+	 * corelate the state that this function has returned and whether the page we
+	 * were trying to lock is paged-in or paged-out.
 	 *
 	 * For the specific reasons of this reliance in this function please refer
 	 * to the comments in MMAP_UNREGISTER() and MMAP_FRAME_EVICT() in mmap.c
 	 */
 	sema_down(&unlocked_frames);
-	lock_acquire(&used_queue_lock);
 	struct fte *frame = kpage_to_fte(kpage);
+	fte_lock(frame);
 
-	if (frame->is_swappable || frame->shared_mmap != shared_mmap) {
-		lock_release(&used_queue_lock);
+	if (frame->owner != fte_owner_word(OWNER_MMAP, shared_mmap)) {
+		fte_unlock(frame);
 
 		/* Frame could not be locked, so restore UNLOCKED_FRAMES to previous
 		 * state.
@@ -183,10 +572,8 @@ bool frame_lock_mmaped(struct shared_mmap *shared_mmap, void *kpage)
 		return false;
 	}
 
-	list_remove(&frame->used_elem);
 	frame_reset(frame);
-
-	lock_release(&used_queue_lock);
+	fte_unlock(frame);
 
 	return true;
 }
@@ -194,12 +581,11 @@ bool frame_lock_mmaped(struct shared_mmap *shared_mmap, void *kpage)
 /* Lock a frame containing swappable page (e.g stack page). */
 bool frame_lock_swappable(uint32_t *pd, void *vpage, void *kpage)
 {
-	/* We cannot optimize this SEMA_DOWN() here because, by the time this
-	 * function exits, it is crucial that the USED_QUEUE_LOCK has been released
-	 * during the potential eviction in FRAME_GET() and that acquiring the
-	 * lock for the specific page that we are evicting there will corelate the
-	 * state that this function has returned and whether the page we were trying
-	 * to lock is paged-in or paged-out.
+	/* By the time this function exits, it is crucial that the frame's lock has
+	 * been released during the potential eviction in FRAME_GET() and that
+	 * acquiring the lock for the specific page that we are evicting there will
+	 * corelate the state that this function has returned and whether the page we
+	 * were trying to lock is paged-in or paged-out.
 	 *
 	 * In this case, this has to do with the PAGEDIR_DESTROY() using this function
 	 * to check whether the page has been evicted to swap or not and whether it
@@ -207,38 +593,61 @@ bool frame_lock_swappable(uint32_t *pd, void *vpage, void *kpage)
 	 * that the page that is being locked here has been evicted to.
 	 */
 	sema_down(&unlocked_frames);
-	lock_acquire(&used_queue_lock);
 	struct fte *frame = kpage_to_fte(kpage);
+	fte_lock(frame);
 
-	if (!frame->is_swappable || frame->pd != pd || frame->vpage != vpage) {
-		lock_release(&used_queue_lock);
+	uint32_t *pte = pagedir_get_pte(pd, vpage);
+	if (frame->owner != fte_owner_word(OWNER_SWAPPABLE, pte)) {
+		fte_unlock(frame);
 		sema_up(&unlocked_frames);
 		return false;
 	}
 
-	list_remove(&frame->used_elem);
 	frame_reset(frame);
+	fte_unlock(frame);
+
+	return true;
+}
+
+/* Lock a frame containing a copy on write page. As with FRAME_LOCK_MMAPED()
+ * the COW system relies on eviction having finished by the time this returns
+ * (see 'cow.c').
+ */
+bool frame_lock_cow(struct cow_page *cow_page, void *kpage)
+{
+	sema_down(&unlocked_frames);
+	struct fte *frame = kpage_to_fte(kpage);
+	fte_lock(frame);
+
+	if (frame->owner != fte_owner_word(OWNER_COW, cow_page)) {
+		fte_unlock(frame);
+		sema_up(&unlocked_frames);
+		return false;
+	}
 
-	lock_release(&used_queue_lock);
+	frame_reset(frame);
+	fte_unlock(frame);
 
 	return true;
 }
 
 /* Reset the frame by NULLifying the owner When a frame is not present,
- * is_swappable = false & shared_mmap = NULL.
+ * owner = OWNER_NONE.
  */
 static void frame_reset(struct fte *entry)
 {
-	entry->is_swappable = false;
-	entry->shared_mmap = NULL;
+	entry->owner = OWNER_NONE;
 }
 
 /* FRAME UNLOCKING:
- * When unlocking a frame we are adding it to the queue of frames that can
- * potentially be evicted by page replacement.
+ * When unlocking a frame we are making it available to be evicted by page
+ * replacement.
  *
  * When unlocking, the FTE is set to ensure the correct access checking,
- * resetting and eviction behaviour.
+ * resetting and eviction behaviour. A locked frame is only accessed by the
+ * process that locked it, so the frame's lock is not needed. The owner is set
+ * last, in one store, as page replacement considers the frame as soon as it has
+ * an owner.
  */
 
 /* Unlock a frame as an mmaped frame. */
@@ -246,13 +655,11 @@ void frame_unlock_mmaped(struct shared_mmap *shared_mmap, void *kpage)
 {
 	struct fte *frame = kpage_to_fte(kpage);
 
-	frame->is_swappable = false;
-	frame->shared_mmap = shared_mmap;
+	ASSERT(frame->owner == OWNER_NONE);
+	policy->unlocked(frame);
+	barrier();
+	frame->owner = fte_owner_word(OWNER_MMAP, shared_mmap);
 
-	lock_acquire(&used_queue_lock);
-	list_push_front(&used_queue, &frame->used_elem);
-
-	lock_release(&used_queue_lock);
 	sema_up(&unlocked_frames);
 }
 
@@ -260,23 +667,71 @@ void frame_unlock_mmaped(struct shared_mmap *shared_mmap, void *kpage)
 void frame_unlock_swappable(uint32_t *pd, void *vpage, void *kpage)
 {
 	struct fte *frame = kpage_to_fte(kpage);
+	uint32_t *pte = pagedir_get_pte(pd, vpage);
 
-	frame->is_swappable = true;
-	frame->pd = pd;
-	frame->vpage = vpage;
+	ASSERT(frame->owner == OWNER_NONE && pte);
+	policy->unlocked(frame);
+	barrier();
+	frame->owner = fte_owner_word(OWNER_SWAPPABLE, pte);
 
-	lock_acquire(&used_queue_lock);
-	list_push_front(&used_queue, &frame->used_elem);
+	sema_up(&unlocked_frames);
+}
+
+/* Unlock a frame as a copy on write frame shared through COW_PAGE. */
+void frame_unlock_cow(struct cow_page *cow_page, void *kpage)
+{
+	struct fte *frame = kpage_to_fte(kpage);
+
+	ASSERT(frame->owner == OWNER_NONE);
+	policy->unlocked(frame);
+	barrier();
+	frame->owner = fte_owner_word(OWNER_COW, cow_page);
 
-	lock_release(&used_queue_lock);
 	sema_up(&unlocked_frames);
 }
 
+/* Take a frame from page replacement for a page locked in memory, returns
+ * false if doing so would leave no frame that can be evicted.
+ */
+bool frame_pin_reserve(void)
+{
+	return sema_try_down(&unlocked_frames);
+}
+
+/* Return the frames of PAGE_CNT pages no longer locked in memory to page
+ * replacement.
+ */
+void frame_pin_release(size_t page_cnt)
+{
+	while (page_cnt-- > 0)
+		sema_up(&unlocked_frames);
+}
+
+/* Wait until any eviction of the frame KPAGE already chosen by page
+ * replacement has set the page table entries of its owner.
+ */
+void frame_wait(void *kpage)
+{
+	if (kpage == zero_frame)
+		return;
+
+	struct fte *frame = kpage_to_fte(kpage);
+	fte_lock(frame);
+	fte_unlock(frame);
+}
+
+/* Release the lock of the frame KPAGE held by its eviction, once the eviction
+ * has taken over the page (see FRAME_EVICT()).
+ */
+void frame_release(void *kpage)
+{
+	fte_unlock(kpage_to_fte(kpage));
+}
+
 /* Mark a page as freed. Frame must be frame locked. */
 void frame_free(void *kpage)
 {
-	ASSERT(!kpage_to_fte(kpage)->is_swappable &&
-				 !kpage_to_fte(kpage)->shared_mmap);
+	ASSERT(kpage_to_fte(kpage)->owner == OWNER_NONE);
 	palloc_free_page(kpage);
 	sema_up(&unlocked_frames);
 }
@@ -293,15 +748,117 @@ void *fte_to_kpage(struct fte *fte)
 	return user_base + (fte - ftes) * PGSIZE;
 }
 
+/* Get the type of the owner of a frame. */
+static inline enum frame_owner fte_owner(const struct fte *entry)
+{
+	return entry->owner & FTE_OWNER_MASK;
+}
+
+/* Get the owner of a frame, a shared_mmap, cow_page or PTE. */
+static inline void *fte_owner_ptr(const struct fte *entry)
+{
+	return (void *)(entry->owner & ~FTE_OWNER_MASK);
+}
+
+/* Get the page directory owning a swappable frame, setting VPAGE to the page
+ * mapped to it.
+ */
+static inline uint32_t *fte_pd(const struct fte *entry, void **vpage)
+{
+	ASSERT(fte_owner(entry) == OWNER_SWAPPABLE);
+	return pagedir_pte_owner(fte_owner_ptr(entry), vpage);
+}
+
+/* Get the reverse map of the page table entries mapping a shared frame. */
+static inline struct rmap *fte_rmap(const struct fte *entry)
+{
+	if (fte_owner(entry) == OWNER_MMAP)
+		return mmap_frame_rmap(fte_owner_ptr(entry));
+	ASSERT(fte_owner(entry) == OWNER_COW);
+	return cow_frame_rmap(fte_owner_ptr(entry));
+}
+
+/* Get the owner word for the owner PTR of type OWNER. */
+static inline uint32_t fte_owner_word(enum frame_owner owner, const void *ptr)
+{
+	ASSERT(((uintptr_t)ptr & FTE_OWNER_MASK) == 0);
+	return (uintptr_t)ptr | owner;
+}
+
+/* Get the list of threads waiting for the lock of a frame. */
+static inline struct list *fte_wait_list(struct fte *entry)
+{
+	return &fte_waiters[(entry - ftes) % FTE_WAIT_BUCKETS];
+}
+
+/* Acquire the lock of a frame, sleeping until it is released. */
+static void fte_lock(struct fte *entry)
+{
+	enum intr_level old_level = intr_disable();
+	while (entry->lock & FTE_LOCKED) {
+		struct fte_waiter waiter = { .frame = entry, .thread = thread_current() };
+
+		list_push_back(fte_wait_list(entry), &waiter.elem);
+		entry->lock |= FTE_WAITERS;
+		thread_block();
+	}
+	entry->lock |= FTE_LOCKED;
+	intr_set_level(old_level);
+}
+
+/* Acquire the lock of a frame if it is not held, returns true on success. */
+static bool fte_try_lock(struct fte *entry)
+{
+	enum intr_level old_level = intr_disable();
+	bool success = !(entry->lock & FTE_LOCKED);
+	if (success)
+		entry->lock |= FTE_LOCKED;
+	intr_set_level(old_level);
+
+	return success;
+}
+
+/* Release the lock of a frame, waking every thread waiting for it to try again.
+ */
+static void fte_unlock(struct fte *entry)
+{
+	enum intr_level old_level = intr_disable();
+	ASSERT(entry->lock & FTE_LOCKED);
+	if (entry->lock & FTE_WAITERS) {
+		struct list *waiters = fte_wait_list(entry);
+		struct list_elem *elem = list_begin(waiters);
+
+		while (elem != list_end(waiters)) {
+			struct fte_waiter *waiter = list_entry(elem, struct fte_waiter, elem);
+			if (waiter->frame == entry) {
+				elem = list_remove(elem);
+				thread_unblock(waiter->thread);
+			} else
+				elem = list_next(elem);
+		}
+	}
+	entry->lock = 0;
+	intr_set_level(old_level);
+}
+
 /* Check if a frame has been accessed, delgating to the correct function for
  * the frame type.
  */
 static inline bool frame_was_accessed(struct fte *entry)
 {
-	if (entry->is_swappable)
-		return swap_page_was_accessed(entry->pd, entry->vpage);
-	else
-		return mmap_frame_was_accessed(entry->shared_mmap);
+	void *vpage;
+	uint32_t *pd;
+
+	switch (fte_owner(entry)) {
+	case OWNER_SWAPPABLE:
+		pd = fte_pd(entry, &vpage);
+		return swap_page_was_accessed(pd, vpage);
+	case OWNER_MMAP:
+	case OWNER_COW:
+		return rmap_was_accessed(fte_rmap(entry));
+	default:
+		NOT_REACHED();
+	}
 }
 
 /* Reset the frame accesses, delgating to the correct function for
@@ -309,8 +866,145 @@ static inline bool frame_was_accessed(struct fte *entry)
  */
 static inline void frame_reset_accessed(struct fte *entry)
 {
-	if (entry->is_swappable)
-		swap_page_reset_accessed(entry->pd, entry->vpage);
-	else
-		mmap_frame_reset_accessed(entry->shared_mmap);
+	void *vpage;
+	uint32_t *pd;
+
+	switch (fte_owner(entry)) {
+	case OWNER_SWAPPABLE:
+		pd = fte_pd(entry, &vpage);
+		swap_page_reset_accessed(pd, vpage);
+		break;
+	case OWNER_MMAP:
+	case OWNER_COW:
+		rmap_reset_accessed(fte_rmap(entry));
+		break;
+	default:
+		NOT_REACHED();
+	}
+}
+
+/* Check if a frame belongs to a process over the resident limit, only
+ * swappable frames have a single owning process.
+ */
+static inline bool frame_over_resident_limit(struct fte *entry)
+{
+	void *vpage;
+
+	return fte_owner(entry) == OWNER_SWAPPABLE &&
+				 pagedir_over_resident_limit(fte_pd(entry, &vpage));
+}
+
+/* Check if the page mapped to a frame is locked in memory by any process
+ * using it, delegating to the correct function for the frame type.
+ */
+static inline bool frame_is_mlocked(struct fte *entry)
+{
+	void *vpage;
+	uint32_t *pd;
+
+	switch (fte_owner(entry)) {
+	case OWNER_SWAPPABLE:
+		pd = fte_pd(entry, &vpage);
+		return pagedir_is_mlocked(pd, vpage);
+	case OWNER_MMAP:
+	case OWNER_COW:
+		return rmap_is_mlocked(fte_rmap(entry));
+	default:
+		return false;
+	}
+}
+
+/* Check if a frame can be discarded rather than evicted, as it is a swappable
+ * frame of a process killed for memory, or that has exited and is waiting for
+ * its page directory to be destroyed.
+ */
+static inline bool frame_is_discardable(struct fte *entry)
+{
+	void *vpage;
+
+	return fte_owner(entry) == OWNER_SWAPPABLE &&
+				 pagedir_is_dead(fte_pd(entry, &vpage)) &&
+				 !frame_is_mlocked(entry);
+}
+
+/* Check if evicting a frame takes a swap slot. */
+static inline bool frame_needs_swap(struct fte *entry)
+{
+	return fte_owner(entry) == OWNER_SWAPPABLE || fte_owner(entry) == OWNER_COW;
+}
+
+/* SECOND CHANCE (CLOCK):
+ * Evict the first frame not accessed since the clock hand last passed it.
+ */
+
+static void clock_unlocked(struct fte *frame UNUSED)
+{
+}
+
+static bool clock_evict(struct fte *frame, unsigned pass UNUSED)
+{
+	if (!frame_was_accessed(frame))
+		return true;
+	frame_reset_accessed(frame);
+	return false;
+}
+
+/* WSCLOCK:
+ * As with the clock, but frames accessed within the last WSCLOCK_TAU ticks are
+ * part of their process's working set and kept even if not accessed since the
+ * last pass. If every frame is in a working set, fall back to the clock after
+ * one full turn.
+ */
+
+static void wsclock_unlocked(struct fte *frame)
+{
+	frame->last_used = (uint16_t)timer_ticks();
+}
+
+static bool wsclock_evict(struct fte *frame, unsigned pass)
+{
+	if (frame_was_accessed(frame)) {
+		frame_reset_accessed(frame);
+		frame->last_used = (uint16_t)timer_ticks();
+		return false;
+	}
+	return pass > 0 ||
+				 (uint16_t)(timer_ticks() - frame->last_used) > WSCLOCK_TAU;
+}
+
+/* 2Q:
+ * A clock approximation of 2Q, frames start in the cold queue and are only
+ * promoted to the hot queue when accessed again after the hand first passes
+ * them, so a single scan through memory only displaces cold frames. Cold frames
+ * are evicted as soon as they are unaccessed, hot frames are demoted instead.
+ * After one full turn, any unaccessed frame is evicted.
+ */
+
+static void two_queue_unlocked(struct fte *frame)
+{
+	frame->flags = FTE_FRESH;
+}
+
+static bool two_queue_evict(struct fte *frame, unsigned pass)
+{
+	bool accessed = frame_was_accessed(frame);
+
+	if (accessed)
+		frame_reset_accessed(frame);
+
+	/* The first access is the one that paged the frame in. */
+	if (frame->flags & FTE_FRESH) {
+		frame->flags &= ~FTE_FRESH;
+		return !accessed && pass > 0;
+	}
+
+	if (accessed) {
+		frame->flags |= FTE_HOT;
+		return false;
+	}
+	if ((frame->flags & FTE_HOT) && pass == 0) {
+		frame->flags &= ~FTE_HOT;
+		return false;
+	}
+	return true;
 }
@@ -7,27 +7,59 @@
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <list.h>
 #include <stdint.h>
 #include "vm/mmap.h"
 #include "vm/swap.h"
 
-void frame_init(void);
+struct cow_page;
+
+void frame_init(const char *policy_name);
 
 /* Get a pointer to a a new locked frame. */
 void *frame_get(void);
 
+/* Get a pointer to a new locked frame, or NULL if there is no free frame. */
+void *frame_try_get(void);
+
+/* Get a pointer to a new locked frame, filled with zeros. */
+void *frame_get_zeroed(void);
+
+/* Get a pointer to a new locked frame of zeros, or NULL if there is no free
+ * frame.
+ */
+void *frame_try_get_zeroed(void);
+
+/* Get the shared frame of zeros, must only be mapped read-only. */
+void *frame_zero_page(void);
+
 /* Lock a frame to prevent page replacement accessing it. For a fill
  * explanation see 'frame.c'.
  */
 bool frame_lock_mmaped(struct shared_mmap *shared_mmap, void *kpage);
 bool frame_lock_swappable(uint32_t *pd, void *vpage, void *kpage);
+bool frame_lock_cow(struct cow_page *cow_page, void *kpage);
 
 /* Unlock a frame so it can potentially be evicted. */
 void frame_unlock_mmaped(struct shared_mmap *shared_mmap, void *kpage);
 void frame_unlock_swappable(uint32_t *pd, void *vpage, void *kpage);
+void frame_unlock_cow(struct cow_page *cow_page, void *kpage);
+
+/* Keep frames for pages locked in memory out of page replacement. */
+bool frame_pin_reserve(void);
+void frame_pin_release(size_t page_cnt);
+void frame_wait(void *kpage);
+
+/* Release a frame chosen by page replacement, once its eviction has taken over
+ * the page.
+ */
+void frame_release(void *kpage);
 
 /* Free a locked frame */
 void frame_free(void *kpage);
 
+/* Wake processes waiting for memory as a process killed for it exits. */
+void frame_oom_exited(void);
+
 #endif
@@ -0,0 +1,179 @@
+#include "vm/ksm.h"
+#include <bitmap.h>
+#include <hash.h>
+#include <list.h>
+#include "devices/timer.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/cow.h"
+#include "vm/frame.h"
+
+/* Same-page merging (KSM) shares identical private pages of different processes
+ * in a single frame, copy on write. Processes running the same program with the
+ * same data can then fit in far fewer frames.
+ *
+ * A scanner thread, started with the "-ksm" option, periodically checks the
+ * writable swappable pages of every registered process. Only stable pages are
+ * merged: pages written to since the last scan (their dirty bit is set) are
+ * skipped, and their dirty bit cleared.
+ *
+ * The contents of each stable page are checksummed and the page merged with
+ * the merged page with the same checksum and contents (see cow_merge()). If
+ * there is no such page, the page itself becomes the merged page for the
+ * checksum, but only once another page with the same checksum has been seen
+ * in the same scan. Merged pages are ordinary copy on write pages, so a write
+ * gives the writer its own copy again.
+ *
+ * While scanning a process, the scanner holds the process's KSM_LOCK. The
+ * process holds it itself while changing the kinds of its own pages in ways
+ * that frame lock them (forking, and freeing pages), as both expect a page
+ * that cannot be frame locked to have been evicted.
+ *
+ * PROCESSES_LOCK is only held to pick the next process to scan, which is moved
+ * to the back of PROCESSES, and to acquire its KSM_LOCK. A process
+ * unregistering (as it exits) therefore only waits for the scan of its own
+ * pages, if in progress, rather than a scan of every process.
+ */
+
+/* Timer ticks between scans, pages not written to in this time are stable. */
+#define KSM_SCAN_INTERVAL (TIMER_FREQ / 4)
+
+/* Number of bits in the filter of checksums seen in a scan. */
+#define KSM_SEEN_BITS 4096
+
+/* The registered processes, protected by PROCESSES_LOCK. Processes are
+ * scanned from the front, and moved to the back when scanned.
+ */
+static struct list processes;
+static struct lock processes_lock;
+
+/* Whether the scanner is running, processes are only registered if so. */
+static bool ksm_enabled;
+
+/* Checksums (modulo KSM_SEEN_BITS) of pages seen in the current scan. */
+static struct bitmap *seen;
+
+static thread_func ksm_scanner NO_RETURN;
+static void ksm_scan(struct thread *t);
+static void ksm_scan_page(struct thread *t, void *vpage);
+
+/* Starts the scanner thread if ENABLED. Threading and the frame system must be
+ * initialised.
+ */
+void ksm_init(bool enabled)
+{
+	list_init(&processes);
+	lock_init(&processes_lock);
+	if (!enabled)
+		return;
+
+	seen = bitmap_create(KSM_SEEN_BITS);
+	if (!seen || thread_create("ksm", PRI_DEFAULT, ksm_scanner, NULL) ==
+													 TID_ERROR)
+		PANIC("Unable to start the same-page merging scanner.");
+	ksm_enabled = true;
+}
+
+/* Registers the process T for scanning, its page directory and copy on write
+ * bookkeeping must be set up.
+ */
+void ksm_register(struct thread *t)
+{
+	if (!ksm_enabled)
+		return;
+
+	lock_acquire(&processes_lock);
+	list_push_back(&processes, &t->ksm_elem);
+	t->ksm_registered = true;
+	lock_release(&processes_lock);
+}
+
+/* Stops scanning the process T, waiting for a scan in progress to finish. */
+void ksm_unregister(struct thread *t)
+{
+	if (!t->ksm_registered)
+		return;
+
+	lock_acquire(&processes_lock);
+	list_remove(&t->ksm_elem);
+	t->ksm_registered = false;
+	lock_release(&processes_lock);
+
+	/* The scanner acquires KSM_LOCK with PROCESSES_LOCK held, so once T is off
+	 * the list, only a scan already in progress can hold it.
+	 */
+	lock_acquire(&t->ksm_lock);
+	lock_release(&t->ksm_lock);
+}
+
+/* Scans every registered process every KSM_SCAN_INTERVAL ticks. */
+static void ksm_scanner(void *aux UNUSED)
+{
+	for (;;) {
+		timer_sleep(KSM_SCAN_INTERVAL);
+
+		bitmap_set_all(seen, false);
+		lock_acquire(&processes_lock);
+		size_t process_cnt = list_size(&processes);
+		lock_release(&processes_lock);
+
+		for (size_t i = 0; i < process_cnt; i++) {
+			lock_acquire(&processes_lock);
+			if (list_empty(&processes)) {
+				lock_release(&processes_lock);
+				break;
+			}
+			struct thread *t =
+							list_entry(list_pop_front(&processes), struct thread, ksm_elem);
+			list_push_back(&processes, &t->ksm_elem);
+			lock_acquire(&t->ksm_lock);
+			lock_release(&processes_lock);
+
+			ksm_scan(t);
+			lock_release(&t->ksm_lock);
+		}
+	}
+}
+
+/* Merges the stable pages of the process T, holding its KSM_LOCK. */
+static void ksm_scan(struct thread *t)
+{
+	for (uint8_t *vpage = pagedir_next_present(t->pagedir, NULL); vpage;
+			 vpage = pagedir_next_present(t->pagedir, vpage + PGSIZE))
+		ksm_scan_page(t, vpage);
+}
+
+/* Merges the page VPAGE of the process T if it is a stable, writable and
+ * swappable page.
+ */
+static void ksm_scan_page(struct thread *t, void *vpage)
+{
+	uint32_t *pd = t->pagedir;
+	uint32_t pte = pagedir_get_raw_pte(pd, vpage);
+
+	/* Pages mapping the zero frame or already copy on write are shared already,
+	 * and read-only pages are left to the page cache.
+	 */
+	if (pte_get_type(pte) != PAGEDIN || pte_is_zero_page(pte) ||
+			pte_is_cow(pte) || !pte_is_writable(pte))
+		return;
+
+	/* Frame locking fails for mmaped pages, and pages being evicted. */
+	void *kpage = pte_get_page(pte);
+	if (!frame_lock_swappable(pd, vpage, kpage))
+		return;
+
+	if (pagedir_is_dirty(pd, vpage)) {
+		pagedir_set_dirty(pd, vpage, false);
+		frame_unlock_swappable(pd, vpage, kpage);
+		return;
+	}
+
+	unsigned checksum = hash_bytes(kpage, PGSIZE);
+	size_t bit = checksum % KSM_SEEN_BITS;
+	if (!cow_merge(pd, &t->cow_users, vpage, kpage, checksum,
+								 bitmap_test(seen, bit)))
+		bitmap_mark(seen, bit);
+}
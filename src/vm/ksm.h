@@ -0,0 +1,14 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include <stdbool.h>
+#include "threads/thread.h"
+
+/* Starts same-page merging, if ENABLED. */
+void ksm_init(bool enabled);
+
+/* Adding and removing the processes scanned for pages to merge. */
+void ksm_register(struct thread *t);
+void ksm_unregister(struct thread *t);
+
+#endif
@@ -1,13 +1,17 @@
 #include "vm/mmap.h"
 #include <hash.h>
+#include <round.h>
 #include <stdint.h>
 #include <string.h>
 #include "filesys/inode.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "vm/frame.h"
+#include "vm/rmap.h"
 
 /* The mmap system maps files to sections of virtual memory in processes'
  * address space.
@@ -18,26 +22,86 @@
  * - Each page to be mmaped from a file is hashed (inode, offset & length).
  * - The MMAPS hashmap is used to check if the file is already being used by
  *   other processes through a SHARED_MMAP (if not register a new one).
+ * - MMAPS is split into MMAP_SHARDS shards by inode and page of the file, each
+ *   with its own hashmap, lock and page cache, so processes loading pages of
+ *   different files (or different pages of the same executable) do not contend
+ *   on a single lock.
  * - SHARED_MMAPs contain file information for the mapped page, as well as a
- *   list of USER_MMAPs. Each USER_MMAP manages a different page table entry
- *   that is using the SHARED_MMAP.
+ *   reverse map of USER_MMAPs (see rmap.c). Each USER_MMAP manages a different
+ *   page table entry that is using the SHARED_MMAP.
  *
- *               +--[map]--+                          +-->+---[list]---+
+ *               +--[map]--+                          +-->+---[rmap]---+
  * +--[key]--+   |         |                          |   | user_mmap  +--> PTE
  * |writable |   |   ...   |   +---[shared-mmap]---+  |   +------------+
  * | length  +-->|  mmaps  +-->|  mmap_system_elem |  |   | user_mmap  +--> PTE
  * | offset  |   |   ...   |   |        ...        |  |   +------------+
- * |  inode  |   |         |   | user_mmaped_pages +--+   | user_mmap  +--> PTE
+ * |  inode  |   |         |   |    users (rmap)   +--+   | user_mmap  +--> PTE
  * +---------+   |         |   +-------------------+      +------------+
  *               +---------+                              | user_mmap  +--> PTE
  *                                                        +------------+
+ *
+ * Read-only SHARED_MMAPs (the pages of executables) act as a page cache. When
+ * the last USER_MMAP unregisters, the SHARED_MMAP is kept in MMAPS along with
+ * its frame and placed on its shard's cache list, so the next process to load
+ * the same executable can map the page without reading it again.
+ *  - Cached pages are never accessed, so are the first frames to be evicted.
+ *  - Cached pages allow writes to their file. If the file's inode is written
+ *    to while cached, the page is stale and is dropped when next registered.
+ *  - At most MMAP_CACHE_PAGES are kept (split between the shards), the oldest
+ *    cached pages of a shard are dropped first.
+ *
+ * Writable data pages of executables are registered as copy on write users
+ * of the read-only SHARED_MMAP. On a write, the user gets its own swappable
+ * copy of the page and unregisters from the SHARED_MMAP.
+ *
+ * Files mapped by processes are MMAP_REGIONs, holding the file and range
+ * mapped. The page table entries of the pages point to the MMAP_REGION until
+ * each page is first faulted on, when it is registered as above. The
+ * USER_MMAPs of a region are kept in page sized chunks, allocated as their
+ * pages are registered, so mapping and unmapping a large file does not
+ * allocate or free anything per page it did not use.
+ *
+ * A fault that reads a page of an executable from its file also reads the
+ * pages after it in the same segment (see READ_AROUND()), so starting a
+ * program does not take a page fault, seek and file system acquisition for
+ * every page of its segments.
+ *
+ * Processes can advise how their mmaped pages will be used (see MMAP_ADVISE()).
+ * On a fault in a page advised as sequential, the following pages are read
+ * ahead, and the page MMAP_EVICT_BEHIND_PAGES behind is marked as not accessed
+ * so page replacement evicts it first.
+ */
+
+/* The number of shards of MMAPS. */
+#define MMAP_SHARDS 16
+
+/* The maximum number of unused pages kept in the page cache, split evenly
+ * between the shards.
+ */
+#define MMAP_CACHE_PAGES 256
+#define MMAP_SHARD_CACHE_PAGES (MMAP_CACHE_PAGES / MMAP_SHARDS)
+
+/* Pages read ahead of, and marked for eviction behind, a fault on a page
+ * advised as sequential.
  */
+#define MMAP_READ_AHEAD_PAGES 8
+#define MMAP_EVICT_BEHIND_PAGES 8
 
-/* hashmap of all SHARED_MMAPs. */
-struct hash mmaps;
+/* The maximum number of pages of an executable read by a single page fault. */
+#define MMAP_FAULT_AROUND_PAGES 8
 
-/* Lock to synchronize access to the MMAPS hash map. */
-struct lock mmaps_lock;
+/* The maximum number of pages written back together by MMAP_SYNC(). */
+#define MMAP_SYNC_BATCH_PAGES 16
+
+/* A shard of MMAPS, the hashmap of all SHARED_MMAPs. */
+struct mmap_shard {
+	struct hash mmaps; /* The shard's SHARED_MMAPs. */
+	struct lock lock; /* Synchronizes access to MMAPS and CACHE. */
+	struct list cache; /* SHARED_MMAPs without users, oldest at the front. */
+	size_t cache_cnt; /* Number of SHARED_MMAPs in CACHE. */
+};
+
+static struct mmap_shard shards[MMAP_SHARDS];
 
 /* Handles the sharing of an mmaped page. Contains a list of user_mmaps for each
  * page using the shared_mmap. Access synchronized through lock.
@@ -52,21 +116,85 @@ struct shared_mmap {
 
 	/* Mmap page information. */
 	bool dirty; /* preserves dirty bit of users unmapping. */
+	void *kpage; /* Frame the page is loaded to, NULL if paged out. */
 	struct lock lock; /* general lock for this SHARED_MMAP. */
-	struct list user_mmaped_pages; /* list of users of that mmap. */
+	bool loading; /* Being read in by a page fault (see LOAD_PAGE()). */
+	struct condition loaded; /* Signalled (with LOCK) when LOADING ends. */
+	struct rmap users; /* Reverse map of the USER_MMAPs of that mmap. */
+
+	/* Page cache information, only used while there are no users. */
+	struct list_elem cache_elem; /* elem for the shard's cache list. */
+	unsigned write_cnt; /* Writes to the file's inode when cached. */
 };
 
 /* Handles the user's page table entry for an mmaped page. */
 struct user_mmap {
-	bool is_lazy; /* Determines struct type (see 'pte.h' lazy/mmap page).*/
+	enum pte_pointer_type type; /* Struct type (see 'pte.h' pointer page). */
 	struct list_elem mmap_id_elem; /* Elem of the bookkeeping list. */
-	struct list_elem shared_mmap_elem; /* Elem of the list of mmap users. */
+	struct rmap_elem mapping; /* Mapping in the SHARED_MMAP's USERS. */
 	struct shared_mmap *shared_mmap; /* Pointer to the mmap for that user. */
 	uint32_t *pd; /* Page directory of the mmapped page. */
 	void *vpage; /* User page within referenced. */
+	struct hash *private_mmaps; /* Process's hashmap if copy on write, or NULL. */
+	struct hash_elem private_elem; /* Elem of PRIVATE_MMAPS. */
+	struct list *mmaping_list; /* The bookkeeping list containing the mmap. */
+	enum mmap_advice advice; /* How the process expects to use the page. */
+	struct mmap_region *region; /* Region containing the page, or NULL. */
+};
+
+/* The number of USER_MMAPs in each chunk of an MMAP_REGION. */
+#define MMAP_REGION_CHUNK_PAGES (PGSIZE / sizeof(struct user_mmap))
+
+/* A file mapped by a process, see MMAP_REGISTER_REGION(). */
+struct mmap_region {
+	enum pte_pointer_type type; /* Struct type (see 'pte.h' pointer page). */
+	struct file *file; /* The mapped file, reopened for the region. */
+	off_t offset; /* Offset within FILE of the first page. */
+	off_t length; /* Number of bytes of FILE mapped. */
+	uint32_t *pd; /* Page directory the region is mapped in. */
+	uint8_t *start; /* First page of the region. */
+	size_t page_cnt; /* Number of pages in the region. */
+	struct user_mmap *chunks[]; /* Pages of USER_MMAPs, NULL until used. */
 };
 
+static bool register_mmap(struct file *file, off_t offset, int16_t length,
+													bool writable, struct hash *private_mmaps,
+													uint32_t *pd, void *vpage,
+													struct list *mmaping_list);
+static bool register_user_mmap(struct user_mmap *user_mmap, struct file *file,
+															 off_t offset, int16_t length, bool writable,
+															 struct hash *private_mmaps, uint32_t *pd,
+															 void *vpage, struct list *mmaping_list);
+static struct mmap_region *region_create(struct file *file, off_t offset,
+																				 off_t length, uint32_t *pd,
+																				 void *start);
+static size_t region_chunk_cnt(size_t page_cnt);
+static struct user_mmap *region_lookup(struct mmap_region *region,
+																			 size_t index);
+static struct user_mmap *region_register(struct mmap_region *region,
+																				 size_t index);
+static struct mmap_shard *shard_of(const struct shared_mmap *shared_mmap);
+static void cache_insert(struct mmap_shard *shard,
+												 struct shared_mmap *shared_mmap);
+static bool cache_take(struct mmap_shard *shard,
+											 struct shared_mmap *shared_mmap);
+static void cache_destroy(struct mmap_shard *shard,
+													struct shared_mmap *shared_mmap);
 static void write_back(struct shared_mmap *shared_mmap, void *kpage);
+static bool load_page(struct user_mmap *user_mmap, bool may_evict);
+static bool start_load(struct user_mmap *user_mmap, bool may_evict,
+											 void **kpage);
+static void finish_load(struct shared_mmap *shared_mmap, void *kpage);
+static void read_pages(struct shared_mmap **shared_mmaps, void **kpages,
+											 size_t page_cnt);
+static void read_around(struct user_mmap *user_mmap, void *kpage);
+static void wait_loaded(struct shared_mmap *shared_mmap);
+static void read_sequential(struct user_mmap *user_mmap);
+static void drop_page(struct user_mmap *user_mmap);
+static bool clean_ptes(struct shared_mmap *shared_mmap);
+static void sync_batch(struct shared_mmap **shared_mmaps, void **kpages,
+											 size_t page_cnt);
+static bool mmap_follows(struct shared_mmap *prev, struct shared_mmap *next);
 static bool mmap_or_ptes(struct shared_mmap *shared_mmap,
 												 bool (*condition)(uint32_t *, const void *));
 
@@ -78,11 +206,37 @@ _Static_assert(_Alignof(struct user_mmap) >= 4,
 hash_hash_func shared_mmap_hash_func;
 hash_less_func shared_mmap_less_func;
 
+/* Access functions for the PRIVATE_MMAPS hashmaps. */
+static hash_hash_func private_hash_func;
+static hash_less_func private_less_func;
+
 /* Initialise the mmapping system. */
 void mmap_init(void)
 {
-	hash_init(&mmaps, shared_mmap_hash_func, shared_mmap_less_func, NULL);
-	lock_init(&mmaps_lock);
+	for (size_t i = 0; i < MMAP_SHARDS; i++) {
+		if (!hash_init(&shards[i].mmaps, shared_mmap_hash_func,
+									 shared_mmap_less_func, NULL))
+			PANIC("Unable to allocate the mmaps hashmap.");
+		lock_init(&shards[i].lock);
+		list_init(&shards[i].cache);
+		shards[i].cache_cnt = 0;
+	}
+}
+
+/* Initialise the hashmap PRIVATE_MMAPS of a process, which maps its virtual
+ * pages to their copy on write USER_MMAPs. Only used by the process itself.
+ */
+bool mmap_private_init(struct hash *private_mmaps)
+{
+	return hash_init(private_mmaps, private_hash_func, private_less_func, NULL);
+}
+
+/* Destroy the hashmap PRIVATE_MMAPS, after its USER_MMAPs have been
+ * unregistered.
+ */
+void mmap_private_destroy(struct hash *private_mmaps)
+{
+	hash_destroy(private_mmaps, NULL);
 }
 
 /* Registers a new mmaped page for FILE at OFFSET.
@@ -110,8 +264,233 @@ bool mmap_register(struct file *file, off_t offset, int16_t length,
 									 bool writable, uint32_t *pd, void *vpage,
 									 struct list *mmaping_list)
 {
-	ASSERT(length <= PGSIZE);
+	return register_mmap(file, offset, length, writable, NULL, pd, vpage,
+											 mmaping_list);
+}
+
+/* Registers a copy on write page for FILE at OFFSET, for writable pages of
+ * executables. The page is shared read-only (as with MMAP_REGISTER()) until
+ * written to, when MMAP_COPY_ON_WRITE() gives the process its own copy. The
+ * USER_MMAP is also kept in the process's PRIVATE_MMAPS, so that it can be
+ * found from the page on a write (see MMAP_FIND_PRIVATE()).
+ */
+bool mmap_register_private(struct file *file, off_t offset, int16_t length,
+													 uint32_t *pd, void *vpage,
+													 struct list *mmaping_list,
+													 struct hash *private_mmaps)
+{
+	return register_mmap(file, offset, length, false, private_mmaps, pd, vpage,
+											 mmaping_list);
+}
+
+/* Maps LENGTH bytes of FILE from OFFSET as writable mmaped pages from the page
+ * START in PD, returning the MMAP_REGION in REGION. The pages are not
+ * registered yet: their page table entries point to the MMAP_REGION, and each
+ * is registered as with MMAP_REGISTER() when first faulted on (see
+ * MMAP_REGION_PAGE()), so mapping a file takes one allocation however large it
+ * is.
+ *
+ * Fails, with no pages mapped, if any of the pages is already set or not below
+ * the stack, or memory cannot be allocated.
+ */
+bool mmap_register_region(struct file *file, off_t offset, off_t length,
+													uint32_t *pd, void *start,
+													struct mmap_region **region)
+{
+	size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	uint8_t *end = (uint8_t *)start + page_cnt * PGSIZE;
+
+	ASSERT(pg_ofs(start) == 0);
+	if (start >= STACK_BOTTOM || pg_no(STACK_BOTTOM) - pg_no(start) < page_cnt)
+		return false;
+	for (uint8_t *vpage = start; vpage < end; vpage += PGSIZE)
+		if (pagedir_get_page_type(pd, vpage) != NOTSET)
+			return false;
+
+	struct mmap_region *new_region =
+					region_create(file, offset, length, pd, start);
+	if (!new_region)
+		return false;
+
+	for (uint8_t *vpage = start; vpage < end; vpage += PGSIZE)
+		if (!pagedir_set_region_page(pd, vpage, new_region)) {
+			mmap_unregister_region(new_region);
+			return false;
+		}
+	*region = new_region;
+	return true;
+}
+
+/* Unregisters the registered pages of REGION and unmaps the rest, then frees
+ * it.
+ */
+void mmap_unregister_region(struct mmap_region *region)
+{
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		struct user_mmap *user_mmap = region_lookup(region, i);
+		uint8_t *vpage = region->start + i * PGSIZE;
+
+		if (user_mmap)
+			mmap_unregister(user_mmap);
+		else if (pagedir_get_page_type(region->pd, vpage) == REGION)
+			pagedir_clear_page(region->pd, vpage);
+	}
+
+	for (size_t i = 0; i < region_chunk_cnt(region->page_cnt); i++)
+		palloc_free_page(region->chunks[i]);
+	filesys_enter();
+	file_close(region->file);
+	filesys_exit();
+	free(region);
+}
+
+/* Maps the pages of REGION in PD at the same virtual pages, returning the new
+ * MMAP_REGION in NEW_REGION. Pages registered in REGION are registered again
+ * for PD with the same advice, sharing their SHARED_MMAPs. Used when forking a
+ * process, the owner of REGION must not be running.
+ *
+ * NEW_REGION is set before any page is mapped, so on failure it must still be
+ * unregistered (see MMAP_UNREGISTER_REGION()) unless it is NULL.
+ */
+bool mmap_clone_region(struct mmap_region *region, uint32_t *pd,
+											 struct mmap_region **new_region)
+{
+	*new_region = region_create(region->file, region->offset, region->length,
+															pd, region->start);
+	if (!*new_region)
+		return false;
+
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		struct user_mmap *user_mmap = region_lookup(region, i);
+		uint8_t *vpage = region->start + i * PGSIZE;
+
+		if (user_mmap) {
+			struct user_mmap *clone = region_register(*new_region, i);
+			if (!clone)
+				return false;
+			clone->advice = user_mmap->advice;
+		} else if (!pagedir_set_region_page(pd, vpage, *new_region)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Returns the USER_MMAP of the page VPAGE of REGION, registering it on its
+ * first use. Returns NULL if memory cannot be allocated.
+ */
+struct user_mmap *mmap_region_page(struct mmap_region *region, void *vpage)
+{
+	ASSERT((uint8_t *)vpage >= region->start);
+	return region_register(region,
+												 ((uint8_t *)vpage - region->start) / PGSIZE);
+}
+
+/* Get the first page of REGION. */
+void *mmap_region_start(struct mmap_region *region)
+{
+	return region->start;
+}
+
+/* Get the end of REGION, the page after its last page. */
+void *mmap_region_end(struct mmap_region *region)
+{
+	return region->start + region->page_cnt * PGSIZE;
+}
+
+/* Allocates an MMAP_REGION of LENGTH bytes of FILE from OFFSET, mapped from the
+ * page START in PD, with none of its pages registered or mapped. Returns NULL
+ * if memory cannot be allocated.
+ */
+static struct mmap_region *region_create(struct file *file, off_t offset,
+																				 off_t length, uint32_t *pd,
+																				 void *start)
+{
+	size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	struct mmap_region *region =
+					calloc(1, sizeof *region +
+												region_chunk_cnt(page_cnt) * sizeof *region->chunks);
+	if (!region)
+		return NULL;
+
+	filesys_enter();
+	region->file = file_reopen(file);
+	filesys_exit();
+	if (!region->file) {
+		free(region);
+		return NULL;
+	}
+
+	region->type = POINTER_REGION;
+	region->offset = offset;
+	region->length = length;
+	region->pd = pd;
+	region->start = start;
+	region->page_cnt = page_cnt;
+	return region;
+}
+
+/* Returns the number of chunks needed for PAGE_CNT pages of a region. */
+static size_t region_chunk_cnt(size_t page_cnt)
+{
+	return DIV_ROUND_UP(page_cnt, MMAP_REGION_CHUNK_PAGES);
+}
+
+/* Returns the USER_MMAP of page INDEX of REGION, or NULL if the page is not
+ * registered.
+ */
+static struct user_mmap *region_lookup(struct mmap_region *region,
+																			 size_t index)
+{
+	struct user_mmap *chunk = region->chunks[index / MMAP_REGION_CHUNK_PAGES];
+	if (!chunk)
+		return NULL;
+
+	struct user_mmap *user_mmap = &chunk[index % MMAP_REGION_CHUNK_PAGES];
+	return user_mmap->shared_mmap ? user_mmap : NULL;
+}
+
+/* Returns the USER_MMAP of page INDEX of REGION, registering the page if it is
+ * not yet registered. Returns NULL if memory cannot be allocated.
+ */
+static struct user_mmap *region_register(struct mmap_region *region,
+																				 size_t index)
+{
+	ASSERT(index < region->page_cnt);
+
+	struct user_mmap **chunk = &region->chunks[index / MMAP_REGION_CHUNK_PAGES];
+	if (!*chunk) {
+		*chunk = palloc_get_page(PAL_ZERO);
+		if (!*chunk)
+			return NULL;
+	}
+
+	/* Unregistered USER_MMAPs have no SHARED_MMAP, and are never in use. */
+	struct user_mmap *user_mmap = &(*chunk)[index % MMAP_REGION_CHUNK_PAGES];
+	if (user_mmap->shared_mmap)
+		return user_mmap;
+
+	off_t page_offset = index * PGSIZE;
+	int16_t page_length = region->length - page_offset < PGSIZE ?
+													region->length - page_offset :
+													PGSIZE;
+	user_mmap->region = region;
+	if (!register_user_mmap(user_mmap, region->file,
+													region->offset + page_offset, page_length, true,
+													NULL, region->pd, region->start + page_offset,
+													NULL))
+		return NULL;
+	return user_mmap;
+}
 
+/* Registers a mmaped page, see MMAP_REGISTER(). If PRIVATE_MMAPS is not NULL,
+ * the user is copy on write and may later take its own copy of the page.
+ */
+static bool register_mmap(struct file *file, off_t offset, int16_t length,
+													bool writable, struct hash *private_mmaps,
+													uint32_t *pd, void *vpage,
+													struct list *mmaping_list)
+{
 	/* Preparing the USER_MMAP. If the malloc() fails here, then we cannot
 	 * proceed further and fail the registering.
 	 */
@@ -119,38 +498,68 @@ bool mmap_register(struct file *file, off_t offset, int16_t length,
 	if (!user_mmap)
 		return false;
 
+	user_mmap->region = NULL;
+	if (!register_user_mmap(user_mmap, file, offset, length, writable,
+													private_mmaps, pd, vpage, mmaping_list)) {
+		free(user_mmap);
+		return false;
+	}
+	return true;
+}
+
+/* Registers the mmaped page managed by the allocated USER_MMAP, see
+ * REGISTER_MMAP(). USER_MMAP is not freed on failure. Pages of a region are
+ * found through it rather than a bookkeeping list, so MMAPING_LIST is NULL.
+ */
+static bool register_user_mmap(struct user_mmap *user_mmap, struct file *file,
+															 off_t offset, int16_t length, bool writable,
+															 struct hash *private_mmaps, uint32_t *pd,
+															 void *vpage, struct list *mmaping_list)
+{
+	ASSERT(length <= PGSIZE);
+
 	/* USER_MMAP setup. */
-	user_mmap->is_lazy = false;
+	user_mmap->type = POINTER_MMAP;
 	user_mmap->pd = pd;
 	user_mmap->vpage = vpage;
+	user_mmap->private_mmaps = private_mmaps;
+	user_mmap->mmaping_list = mmaping_list;
+	user_mmap->advice = MMAP_NORMAL;
 
 	/* Create key for MMAPS hashmap access. */
 	struct shared_mmap key = {
 		.file = file, .file_offset = offset, .length = length, .writable = writable
 	};
 
-	/* Acquire the MMAPS_LOCK for exclusive access to the MMAPS hashmap. */
-	lock_acquire(&mmaps_lock);
+	/* Acquire the shard's lock for exclusive access to its MMAPS hashmap. */
+	struct mmap_shard *shard = shard_of(&key);
+	lock_acquire(&shard->lock);
 
 	/* If a SHARED_MMAP already exists, register the USER_MMAP with it, if not
 	 * create a new SHARED_MMAP to register with.
 	 */
 	struct shared_mmap *shared_mmap =
-					hash_entry(hash_find(&mmaps, &key.mmap_system_elem),
+					hash_entry(hash_find(&shard->mmaps, &key.mmap_system_elem),
 										 struct shared_mmap, mmap_system_elem);
+
+	/* A SHARED_MMAP without users is in the page cache, and must be taken out
+	 * of it before use. If it is stale it is destroyed, so create a new one.
+	 */
+	if (shared_mmap && rmap_is_empty(&shared_mmap->users) &&
+			!cache_take(shard, shared_mmap))
+		shared_mmap = NULL;
+
 	if (!shared_mmap) {
 		shared_mmap = malloc(sizeof(struct shared_mmap));
 
 		if (!shared_mmap) {
-			lock_release(&mmaps_lock);
-			free(user_mmap);
+			lock_release(&shard->lock);
 			return false;
 		}
 
 		/* Check in case the allocation of a new page table fails */
 		if (!pagedir_set_mmaped_page(pd, vpage, user_mmap)) {
-			lock_release(&mmaps_lock);
-			free(user_mmap);
+			lock_release(&shard->lock);
 			free(shared_mmap);
 			return false;
 		}
@@ -162,8 +571,7 @@ bool mmap_register(struct file *file, off_t offset, int16_t length,
 		shared_mmap->file = file_reopen(file);
 		if (!shared_mmap->file) {
 			filesys_exit();
-			lock_release(&mmaps_lock);
-			free(user_mmap);
+			lock_release(&shard->lock);
 			free(shared_mmap);
 			pagedir_clear_page(pd, vpage);
 			return false;
@@ -176,76 +584,76 @@ bool mmap_register(struct file *file, off_t offset, int16_t length,
 		shared_mmap->length = length;
 		shared_mmap->writable = writable;
 		shared_mmap->dirty = false;
+		shared_mmap->kpage = NULL;
 		lock_init(&shared_mmap->lock);
+		shared_mmap->loading = false;
+		cond_init(&shared_mmap->loaded);
 
 		/* Insert the USER_MMAP into the SHARED_MMAP */
-		list_init(&shared_mmap->user_mmaped_pages);
-		list_push_back(&shared_mmap->user_mmaped_pages,
-									 &user_mmap->shared_mmap_elem);
+		rmap_init(&shared_mmap->users);
+		rmap_add(&shared_mmap->users, &user_mmap->mapping, pd, vpage);
 
 		/* Insert into the MMAPS hashmap & release lock to allow access. */
-		if (hash_insert(&mmaps, &shared_mmap->mmap_system_elem))
+		if (hash_insert(&shard->mmaps, &shared_mmap->mmap_system_elem))
 			NOT_REACHED();
-		lock_release(&mmaps_lock);
+		lock_release(&shard->lock);
 	} else {
-		/* Release access to MMAPS hashmap, but keep continuous exclusive access to
-		 * SHARED_MMAP to prevent removal.
+		/* Keep exclusive access to the MMAPS hashmap, as if the SHARED_MMAP was
+		 * taken from the page cache, it must be returned there if registering
+		 * fails. Acquire the SHARED_MMAP lock to prevent removal.
 		 */
 		lock_acquire(&shared_mmap->lock);
-		lock_release(&mmaps_lock);
-
-		/* Invariant: SHARED_MMAPs must have at least one USER_MMAP. */
-		ASSERT(!list_empty(&shared_mmap->user_mmaped_pages));
 
 		/* This is an initialization of the new page table entry (pte) for the
 		 * USER_MMAP:
 		 *   - Access to the list of users is synchronized by acquiring the
 		 *     SHARED_MMAP lock.
-		 *   - Access to the page table entry of the other user is synchronized
-		 *     as in order to modify a PTE associated with an MMAP, the SHARED_MMAP
-		 *     lock must be acquired.
-		 * We can then use the page table entry of another sharing the mmap as:
-		 *   - If the page table entry is not present, we can update the page table
-		 *     entry with a pointer to the new USER_MMAP (See pte.h).
-		 *   - If the page table entry is present, we can copy it to the current
-		 *     process as the physical address, writability, etc, will be
-		 *     the same. The dirty bit can be copied as the SHARED_MMAP's dirtiness
+		 *   - The frame the page is loaded to (if any) can only change with the
+		 *     SHARED_MMAP lock acquired, and all page table entries of users are
+		 *     updated with it.
+		 * So we can use the SHARED_MMAP's frame:
+		 *   - If the page is not loaded, we can update the page table entry with
+		 *     a pointer to the new USER_MMAP (See pte.h).
+		 *   - If the page is loaded, we can map the frame with the SHARED_MMAP's
+		 *     writability. The dirty bit is false, as the SHARED_MMAP's dirtiness
 		 *     is the disjunction (OR) of all pte's dirty bits.
 		 */
-		struct user_mmap *other_user_mmap =
-						list_entry(list_front(&shared_mmap->user_mmaped_pages),
-											 struct user_mmap, shared_mmap_elem);
-		void *kpage = pagedir_get_page(other_user_mmap->pd, other_user_mmap->vpage);
-
 		bool pagedir_success;
-		if (kpage)
-			pagedir_success = pagedir_set_page(
-							pd, vpage, kpage,
-							pagedir_is_writable(other_user_mmap->pd, other_user_mmap->vpage));
+		if (shared_mmap->kpage)
+			pagedir_success = pagedir_set_page(pd, vpage, shared_mmap->kpage,
+																				 shared_mmap->writable);
 		else
 			pagedir_success = pagedir_set_mmaped_page(pd, vpage, user_mmap);
 
-		/* If pagedir cannot be set, fail allocation. */
+		/* If pagedir cannot be set, fail allocation, returning an unused
+		 * SHARED_MMAP to the page cache.
+		 */
 		if (!pagedir_success) {
+			bool unused = rmap_is_empty(&shared_mmap->users);
 			lock_release(&shared_mmap->lock);
-			free(user_mmap);
+			if (unused)
+				cache_insert(shard, shared_mmap);
+			lock_release(&shard->lock);
 			return false;
 		}
 
-		/* Finalise the setup of the USER_MMAP by inserting it into the list of
-		 * USER_MMAPED_PAGES in the SHARED_MMAP.
+		/* Finalise the setup of the USER_MMAP by inserting it into the reverse
+		 * map of USERS in the SHARED_MMAP.
 		 */
-		list_push_back(&shared_mmap->user_mmaped_pages,
-									 &user_mmap->shared_mmap_elem);
+		rmap_add(&shared_mmap->users, &user_mmap->mapping, pd, vpage);
 
 		lock_release(&shared_mmap->lock);
+		lock_release(&shard->lock);
 	}
 
 	/* USER_MMAP's pointer to the SHARED_MMAP is only used by the thread that
 	 * owns the USER_MMAP, so no synchronisation needed for setting it.
 	 */
 	user_mmap->shared_mmap = shared_mmap;
-	list_push_back(mmaping_list, &user_mmap->mmap_id_elem);
+	if (mmaping_list)
+		list_push_back(mmaping_list, &user_mmap->mmap_id_elem);
+	if (private_mmaps)
+		hash_insert(private_mmaps, &user_mmap->private_elem);
 	return true;
 }
 
@@ -254,7 +662,8 @@ bool mmap_register(struct file *file, off_t offset, int16_t length,
  * USER_MMAP struct.
  *
  * If the unregistering process is the final one using the SHARED_MMAP, then it
- * is removed from the mmaping system.
+ * is removed from the mmaping system, or for read-only mmaps kept in the page
+ * cache.
  */
 void mmap_unregister(struct user_mmap *user_mmap)
 {
@@ -262,21 +671,22 @@ void mmap_unregister(struct user_mmap *user_mmap)
 
 	/* We acquire this lock to ensure that no one can register themselves into
 	 * the SHARED_MMAP while we are evicting it, and no other processes can search
-	 * the MMAPs hashmap for the SHARED_MMAP (as we may remove it).
+	 * its shard of the MMAPS hashmap for the SHARED_MMAP (as we may remove it).
 	 *
 	 * We also need this lock to be able to assume that the number of users of
 	 * this shared_mmap will not have changed between the line below where
 	 * we are frame locking and the time where we are testing if we are the
 	 * sole user of that shared_mmap.
 	 */
-	lock_acquire(&mmaps_lock);
+	struct mmap_shard *shard = shard_of(shared_mmap);
+	lock_acquire(&shard->lock);
 
 	/* The assumption here is that if in the future we are the lone user
 	 * of that shared_mmap, and this frame_lock has failed, then the mmap will
 	 * have been both paged out and any potential frame evicitons
 	 * (MMAP_FRAME_EVICT) finished.
 	 *
-	 * If we did not acquire the mmaps_lock above, then it could have been that
+	 * If we did not acquire the shard's lock above, then it could have been that
 	 * the number of users would have changed by the time we get to
 	 * LIST_ELEM_ALONE, so our assumption about the retroactive implication of a
 	 * state that we will be in is broken - we will not have been able to make
@@ -284,7 +694,7 @@ void mmap_unregister(struct user_mmap *user_mmap)
 	 *
 	 * This statement also needs to be before we acquire the shared_mmap lock,
 	 * because in the other case it can cause a deadlock with the acquisition of
-	 * that lock inside of the eviction function and the USED_QUEUE_LOCK.
+	 * that lock inside of the eviction function and the frame's lock.
 	 */
 	void *kpage = pagedir_get_page(user_mmap->pd, user_mmap->vpage);
 	if (kpage && !frame_lock_mmaped(shared_mmap, kpage))
@@ -292,28 +702,27 @@ void mmap_unregister(struct user_mmap *user_mmap)
 
 	lock_acquire(&shared_mmap->lock);
 
-	/* If the USER_MMAP is the last, remove the SHARED_MMAP, else just remove the
-	 * USER_MMAP.
+	/* If the USER_MMAP is the last of a writable mmap, remove the SHARED_MMAP,
+	 * else just remove the USER_MMAP.
 	 */
-	if (list_elem_alone(&user_mmap->shared_mmap_elem)) {
+	if (list_elem_alone(&user_mmap->mapping.elem) && shared_mmap->writable) {
 		/* We release that lock since we know that:
 		 *  - this entry will be deleted from the mmaps hash before we free the lock
 		 *    for it, so no one can register themselves to this shared_mmap at any
 		 *    point in the future
 		 *  - this entry will not be paged out by the framing system since, because
-		 *    the FRAME_LOCK_MMAPED() acquires the USED_QUEUE_LOCK and because,
+		 *    the FRAME_LOCK_MMAPED() acquires the frame's lock and because,
 		 *    after that, we have acquired this shared mmap's lock, all evictions
 		 *    that can potentially happen on this shared mmap would have finished
 		 *    already.
 		 */
 		lock_release(&shared_mmap->lock);
 
-		/* Remove the SHARED_MMAP, release the MMAPS hashmap afterwards as the
-		 * SHARED_MMAP is no longer in the mmaping system, so only this process can
-		 * access.
+		/* Remove the SHARED_MMAP, release the shard afterwards as the SHARED_MMAP
+		 * is no longer in the mmaping system, so only this process can access.
 		 */
-		hash_delete(&mmaps, &shared_mmap->mmap_system_elem);
-		lock_release(&mmaps_lock);
+		hash_delete(&shard->mmaps, &shared_mmap->mmap_system_elem);
+		lock_release(&shard->lock);
 
 		/* When we were locking this frame, we knew that the number of users of
 		 * this mmap would not have changed by the time we ascertained that we
@@ -340,36 +749,79 @@ void mmap_unregister(struct user_mmap *user_mmap)
 
 		free(shared_mmap);
 	} else {
-		/* If we are not the only user, we can release that frame lock here.
-		 * However, we still need to ensure that no IO for this mmap can happen for
-		 * other processes that might be waiting to unregister themselves from this
-		 * mmap, so therefore we cannot release the lock on the MMAPS_LOCK before
-		 * freeing this frame.
+		/* If we are not the only user, or the page is to be cached, we can release
+		 * that frame lock here. However, we still need to ensure that no IO for
+		 * this mmap can happen for other processes that might be waiting to
+		 * unregister themselves from this mmap, so therefore we cannot release the
+		 * shard's lock before freeing this frame.
 		 */
 		if (kpage)
 			frame_unlock_mmaped(shared_mmap, kpage);
 
-		/* We are not destroying the SHARED_MMAP, so it is fine for other processes
-		 * to attempt to use it. Hence we release the lock on the MMAPS hashmap.
-		 */
-		lock_release(&mmaps_lock);
-
 		/* Remove the USER_MMAP from the SHARED_MMAP. If the page is dirty,
 		 * preserve this in the DIRTY feild of the SHARED MMAP.
 		 */
-		list_remove(&user_mmap->shared_mmap_elem);
+		rmap_remove(&shared_mmap->users, &user_mmap->mapping);
 		if (pagedir_get_page_type(user_mmap->pd, user_mmap->vpage) == PAGEDIN)
 			shared_mmap->dirty |= pagedir_is_dirty(user_mmap->pd, user_mmap->vpage);
 
+		bool unused = rmap_is_empty(&shared_mmap->users);
 		lock_release(&shared_mmap->lock);
+
+		/* The last user of a read-only mmap leaves it in the page cache. The
+		 * shard's lock is held until then, so no one can register in between.
+		 */
+		if (unused)
+			cache_insert(shard, shared_mmap);
+		lock_release(&shard->lock);
 	}
 
 	/* USER_MMAP is no longer coupled to any SHARED_MMAP at this point, so we do
    * not need to synchronize it.
 	 */
 	pagedir_clear_page(user_mmap->pd, user_mmap->vpage);
-	list_remove(&user_mmap->mmap_id_elem);
-	free(user_mmap);
+	if (user_mmap->private_mmaps)
+		hash_delete(user_mmap->private_mmaps, &user_mmap->private_elem);
+	if (user_mmap->region) {
+		user_mmap->shared_mmap = NULL;
+	} else {
+		list_remove(&user_mmap->mmap_id_elem);
+		free(user_mmap);
+	}
+}
+
+/* Registers PD as another user of each of the mmaped pages in MMAPING_LIST, at
+ * the same virtual pages, adding them to the bookkeeping list NEW_MMAPING_LIST,
+ * and the copy on write users to NEW_PRIVATE_MMAPS. Used when forking a
+ * process, the owner of MMAPING_LIST must not be running.
+ */
+bool mmap_clone_all(struct list *mmaping_list, uint32_t *pd,
+										struct list *new_mmaping_list,
+										struct hash *new_private_mmaps)
+{
+	for (struct list_elem *elem = list_begin(mmaping_list);
+			 elem != list_end(mmaping_list); elem = list_next(elem)) {
+		struct user_mmap *user_mmap = mmap_list_entry(elem);
+		struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+
+		/* The SHARED_MMAP cannot be removed as USER_MMAP is still registered. */
+		if (!register_mmap(shared_mmap->file, shared_mmap->file_offset,
+											 shared_mmap->length, shared_mmap->writable,
+											 user_mmap->private_mmaps ? new_private_mmaps : NULL,
+											 pd, user_mmap->vpage, new_mmaping_list))
+			return false;
+	}
+	return true;
+}
+
+/* Returns the copy on write USER_MMAP in the process's PRIVATE_MMAPS for the
+ * user page VPAGE, or NULL if there is none.
+ */
+struct user_mmap *mmap_find_private(struct hash *private_mmaps, void *vpage)
+{
+	struct user_mmap key = { .vpage = vpage };
+	struct hash_elem *elem = hash_find(private_mmaps, &key.private_elem);
+	return elem ? hash_entry(elem, struct user_mmap, private_elem) : NULL;
 }
 
 /* Function for converting the elem of the list of mmapings provided in
@@ -380,23 +832,81 @@ struct user_mmap *mmap_list_entry(struct list_elem *elem)
 	return list_entry(elem, struct user_mmap, mmap_id_elem);
 }
 
-/* Loads the mmap into the given page and updates all its users.
- * KPAGE must be page-locked.
+/* Loads the mmap into a new frame and updates all its users. If the page was
+ * advised as sequential, the following pages are read ahead. Pages of
+ * executables are read along with the rest of their segment (see
+ * READ_AROUND()).
  */
 void mmap_load(struct user_mmap *user_mmap)
+{
+	struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+	void *kpage;
+
+	if (shared_mmap->writable) {
+		load_page(user_mmap, true);
+		if (user_mmap->advice == MMAP_SEQUENTIAL)
+			read_sequential(user_mmap);
+	} else if (start_load(user_mmap, true, &kpage) && kpage) {
+		read_around(user_mmap, kpage);
+		finish_load(shared_mmap, kpage);
+	}
+}
+
+/* Loads the mmap into a new frame and updates all its users, unless it is
+ * already loaded. If MAY_EVICT is false, only a free frame is used, returning
+ * false if there is none or the page is being loaded by another user.
+ *
+ * The file is read without the SHARED_MMAP lock, with LOADING set so that
+ * other users faulting on the page wait for the read rather than repeating it
+ * (e.g. processes launching the same executable at once). Until the read is
+ * done the page is not loaded as far as the rest of the mmap system is
+ * concerned: KPAGE is NULL and the users' page table entries still point to
+ * their USER_MMAPs, so registering, unregistering and write backs proceed as
+ * normal. Users added meanwhile are mapped to the frame along with the rest.
+ * The SHARED_MMAP cannot be freed during the read, as the faulting process
+ * remains one of its users.
+ */
+static bool load_page(struct user_mmap *user_mmap, bool may_evict)
+{
+	struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+	void *kpage;
+
+	if (!start_load(user_mmap, may_evict, &kpage))
+		return false;
+	if (kpage) {
+		read_pages(&shared_mmap, &kpage, 1);
+		finish_load(shared_mmap, kpage);
+	}
+	return true;
+}
+
+/* Starts loading the page of USER_MMAP (see LOAD_PAGE()), setting KPAGE to the
+ * frame locked frame to read it into, or to NULL if it is already loaded. If
+ * MAY_EVICT is false, only a free frame is used, and a page being loaded by
+ * another user is not waited for, returning false instead.
+ */
+static bool start_load(struct user_mmap *user_mmap, bool may_evict,
+											 void **kpage)
 {
 	struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
 
+	*kpage = NULL;
 	lock_acquire(&shared_mmap->lock);
+	if (!may_evict && shared_mmap->loading) {
+		lock_release(&shared_mmap->lock);
+		return false;
+	}
+	wait_loaded(shared_mmap);
 
 	/* If the mmap is already loaded, can just return. */
 	if (pagedir_get_page_type(user_mmap->pd, user_mmap->vpage) != MMAPED) {
 		lock_release(&shared_mmap->lock);
-		return;
+		return true;
 	}
 
-	/* KPAGE is frame locked (cannot be evicted) and the SHARED_MMAP lock is
-	 * acquired, so exclusive access to ensured. Hence it is safe to read.
+	/* KPAGE is frame locked (cannot be evicted) and LOADING is set below before
+	 * the SHARED_MMAP lock is released, so exclusive access is ensured. Hence it
+	 * is safe to read.
 	 *
 	 * There is no deadlock here since, in order for FRAME_GET() to attempt to
 	 * acquire the lock for that shared mmap, we must be paged in. However, this
@@ -406,25 +916,31 @@ void mmap_load(struct user_mmap *user_mmap)
 	 * in which we are synchronized already thanks to having the lock for this
 	 * shared mmap acquired.
 	 */
-	void *kpage = frame_get();
-	filesys_enter();
-	file_seek(shared_mmap->file, shared_mmap->file_offset);
-	file_read(shared_mmap->file, kpage, shared_mmap->length);
-	filesys_exit();
+	*kpage = may_evict ? frame_get() : frame_try_get();
+	if (*kpage)
+		shared_mmap->loading = true;
+	lock_release(&shared_mmap->lock);
+	return *kpage != NULL;
+}
 
-	/* If the section of file is not a whole page, fill the remainder of the page
-	 * with zeros.
-	 */
-	memset(kpage + shared_mmap->length, 0, PGSIZE - shared_mmap->length);
+/* Finishes loading SHARED_MMAP once its page has been read into the frame
+ * locked KPAGE, mapping the frame for all of its users and unlocking it.
+ */
+static void finish_load(struct shared_mmap *shared_mmap, void *kpage)
+{
+	lock_acquire(&shared_mmap->lock);
+	shared_mmap->kpage = kpage;
+	shared_mmap->loading = false;
+	cond_broadcast(&shared_mmap->loaded, &shared_mmap->lock);
 
 	/* Update every page table entry connected to that SHARED_MMAP. Exclusive
 	 * access to pte is ensured since we have the lock on the SHARED_MMAP as well.
 	 */
-	for (struct list_elem *elem = list_begin(&shared_mmap->user_mmaped_pages);
-			 elem != list_end(&shared_mmap->user_mmaped_pages);
+	for (struct list_elem *elem = list_begin(&shared_mmap->users.mappings);
+			 elem != list_end(&shared_mmap->users.mappings);
 			 elem = list_next(elem)) {
 		struct user_mmap *user_mmap =
-						list_entry(elem, struct user_mmap, shared_mmap_elem);
+						list_entry(elem, struct user_mmap, mapping.elem);
 		pagedir_set_page(user_mmap->pd, user_mmap->vpage, kpage,
 										 shared_mmap->writable);
 	}
@@ -434,17 +950,345 @@ void mmap_load(struct user_mmap *user_mmap)
 	frame_unlock_mmaped(shared_mmap, kpage);
 }
 
+/* Reads the pages of the PAGE_CNT consecutive SHARED_MMAPS (see MMAP_FOLLOWS())
+ * into KPAGES with a single seek while holding the filesystem once, filling the
+ * remainder of each page with zeros.
+ */
+static void read_pages(struct shared_mmap **shared_mmaps, void **kpages,
+											 size_t page_cnt)
+{
+	filesys_enter();
+	file_seek(shared_mmaps[0]->file, shared_mmaps[0]->file_offset);
+	for (size_t i = 0; i < page_cnt; i++)
+		file_read(shared_mmaps[0]->file, kpages[i], shared_mmaps[i]->length);
+	filesys_exit();
+
+	for (size_t i = 0; i < page_cnt; i++)
+		memset(kpages[i] + shared_mmaps[i]->length, 0,
+					 PGSIZE - shared_mmaps[i]->length);
+}
+
+/* Reads the page of USER_MMAP, a page of an executable, into KPAGE, along with
+ * up to MMAP_FAULT_AROUND_PAGES - 1 pages directly after it that continue on in
+ * the same file (the rest of its segment) and are not loaded:
+ * 1. Start loading the following pages, but only while free frames are
+ *    available (no page replacement) and the process is within its resident
+ *    limit.
+ * 2. Read all the pages in one sequential read from the file system.
+ * 3. Finish loading the following pages, mapping them for all their users.
+ *
+ * KPAGE is either the frame being loaded for USER_MMAP's SHARED_MMAP, or the
+ * copy of a copy on write user, so the caller finishes with it.
+ */
+static void read_around(struct user_mmap *user_mmap, void *kpage)
+{
+	struct shared_mmap *shared_mmaps[MMAP_FAULT_AROUND_PAGES];
+	void *kpages[MMAP_FAULT_AROUND_PAGES];
+	size_t max_pages = pagedir_over_resident_limit(user_mmap->pd) ?
+													 1 :
+													 MMAP_FAULT_AROUND_PAGES;
+	size_t page_cnt;
+
+	shared_mmaps[0] = user_mmap->shared_mmap;
+	kpages[0] = kpage;
+
+	/* Only this process unregisters its USER_MMAPs, so the one a page table
+	 * entry points to cannot be freed under us. Whether it is still not loaded
+	 * is checked again by START_LOAD().
+	 */
+	for (page_cnt = 1; page_cnt < max_pages; page_cnt++) {
+		uint8_t *vpage = (uint8_t *)user_mmap->vpage + page_cnt * PGSIZE;
+		if (!is_user_vaddr(vpage))
+			break;
+
+		uint32_t pte_val = pagedir_get_raw_pte(user_mmap->pd, vpage);
+		if (pte_get_type(pte_val) != MMAPED)
+			break;
+		struct user_mmap *next = pte_get_user_mmap(pte_val);
+		if (next->shared_mmap->writable ||
+				!mmap_follows(shared_mmaps[page_cnt - 1], next->shared_mmap) ||
+				!start_load(next, false, &kpages[page_cnt]) || !kpages[page_cnt])
+			break;
+		shared_mmaps[page_cnt] = next->shared_mmap;
+	}
+
+	read_pages(shared_mmaps, kpages, page_cnt);
+	for (size_t i = 1; i < page_cnt; i++)
+		finish_load(shared_mmaps[i], kpages[i]);
+}
+
+/* Waits until no page fault is reading SHARED_MMAP in, its lock must be
+ * held.
+ */
+static void wait_loaded(struct shared_mmap *shared_mmap)
+{
+	while (shared_mmap->loading)
+		cond_wait(&shared_mmap->loaded, &shared_mmap->lock);
+}
+
+/* Reads ahead the pages following USER_MMAP in its region while they are
+ * advised as sequential and free frames are available, and marks the page
+ * MMAP_EVICT_BEHIND_PAGES behind it as not accessed, as a sequential scan will
+ * not use it again.
+ */
+static void read_sequential(struct user_mmap *user_mmap)
+{
+	struct mmap_region *region = user_mmap->region;
+	ASSERT(region);
+	size_t index = ((uint8_t *)user_mmap->vpage - region->start) / PGSIZE;
+	struct user_mmap *behind_user =
+		index >= MMAP_EVICT_BEHIND_PAGES ?
+			region_lookup(region, index - MMAP_EVICT_BEHIND_PAGES) :
+			NULL;
+
+	if (behind_user && behind_user->advice == MMAP_SEQUENTIAL) {
+		struct shared_mmap *behind = behind_user->shared_mmap;
+
+		/* The accessed bits can only be reset while the page is loaded. */
+		lock_acquire(&behind->lock);
+		if (behind->kpage)
+			for (struct list_elem *e = list_begin(&behind->users.mappings);
+					 e != list_end(&behind->users.mappings); e = list_next(e)) {
+				struct user_mmap *user =
+								list_entry(e, struct user_mmap, mapping.elem);
+				pagedir_set_accessed(user->pd, user->vpage, false);
+			}
+		lock_release(&behind->lock);
+	}
+
+	for (size_t i = index + 1;
+			 i <= index + MMAP_READ_AHEAD_PAGES && i < region->page_cnt; i++) {
+		struct user_mmap *next = region_lookup(region, i);
+		if (!next || next->advice != MMAP_SEQUENTIAL || !load_page(next, false))
+			break;
+	}
+}
+
+/* Applies ADVICE to the pages of REGION from START up to END, registering the
+ * pages first unless ADVICE is MMAP_NORMAL or MMAP_DONTNEED:
+ * - MMAP_NORMAL and MMAP_SEQUENTIAL set how faults on the pages are handled.
+ * - MMAP_WILLNEED loads the pages now.
+ * - MMAP_DONTNEED frees the frames of clean pages without writing them back,
+ *   they are read from the file again when next accessed. Dirty pages are left
+ *   to be written back by MMAP_SYNC() or page replacement.
+ */
+void mmap_advise(struct mmap_region *region, void *start, void *end,
+								 enum mmap_advice advice)
+{
+	bool register_pages = advice != MMAP_NORMAL && advice != MMAP_DONTNEED;
+
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		uint8_t *vpage = region->start + i * PGSIZE;
+		if ((void *)vpage < start || (void *)vpage >= end)
+			continue;
+		struct user_mmap *user_mmap = register_pages ?
+																		region_register(region, i) :
+																		region_lookup(region, i);
+		if (!user_mmap)
+			continue;
+
+		switch (advice) {
+		case MMAP_NORMAL:
+		case MMAP_SEQUENTIAL:
+			user_mmap->advice = advice;
+			break;
+		case MMAP_WILLNEED:
+			load_page(user_mmap, true);
+			break;
+		case MMAP_DONTNEED:
+			drop_page(user_mmap);
+			break;
+		default:
+			NOT_REACHED();
+		}
+	}
+}
+
+/* Frees the frame of USER_MMAP's page if it is loaded and clean, so every user
+ * reloads it from the file on its next access.
+ */
+static void drop_page(struct user_mmap *user_mmap)
+{
+	struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+
+	/* As for MMAP_SYNC(), a page that cannot be frame locked is not in memory.
+	 * With the frame locked the page cannot be loaded or evicted by others.
+	 */
+	void *kpage = pagedir_get_page(user_mmap->pd, user_mmap->vpage);
+	if (!kpage || !frame_lock_mmaped(shared_mmap, kpage))
+		return;
+
+	lock_acquire(&shared_mmap->lock);
+	bool dirty =
+		shared_mmap->dirty || mmap_or_ptes(shared_mmap, pagedir_is_dirty);
+	if (!dirty) {
+		shared_mmap->kpage = NULL;
+		for (struct list_elem *elem = list_begin(&shared_mmap->users.mappings);
+				 elem != list_end(&shared_mmap->users.mappings);
+				 elem = list_next(elem)) {
+			struct user_mmap *user =
+							list_entry(elem, struct user_mmap, mapping.elem);
+			pagedir_set_mmaped_page(user->pd, user->vpage, user);
+		}
+	}
+	lock_release(&shared_mmap->lock);
+
+	if (dirty)
+		frame_unlock_mmaped(shared_mmap, kpage);
+	else
+		frame_free(kpage);
+}
+
+/* Writes back the dirty pages of REGION from START up to END. Runs of
+ * consecutive pages of a file are written with a single seek while holding
+ * the filesystem once, up to MMAP_SYNC_BATCH_PAGES at a time.
+ *
+ * A page that cannot be frame locked is not in memory, so has already been
+ * written back by its eviction. The frames of a batch stay frame locked until
+ * written, and their page table entries are marked clean before writing, so
+ * writes made during the write back mark the page dirty again.
+ */
+void mmap_sync(struct mmap_region *region, void *start, void *end)
+{
+	struct shared_mmap *batch[MMAP_SYNC_BATCH_PAGES];
+	void *kpages[MMAP_SYNC_BATCH_PAGES];
+	size_t batch_cnt = 0;
+
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		struct user_mmap *user_mmap = region_lookup(region, i);
+		if (!user_mmap || user_mmap->vpage < start || user_mmap->vpage >= end)
+			continue;
+		struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+
+		void *kpage = pagedir_get_page(user_mmap->pd, user_mmap->vpage);
+		if (!kpage || !frame_lock_mmaped(shared_mmap, kpage))
+			continue;
+
+		lock_acquire(&shared_mmap->lock);
+		bool dirty = clean_ptes(shared_mmap);
+		lock_release(&shared_mmap->lock);
+		if (!dirty) {
+			frame_unlock_mmaped(shared_mmap, kpage);
+			continue;
+		}
+
+		if (batch_cnt == MMAP_SYNC_BATCH_PAGES ||
+				(batch_cnt > 0 && !mmap_follows(batch[batch_cnt - 1], shared_mmap))) {
+			sync_batch(batch, kpages, batch_cnt);
+			batch_cnt = 0;
+		}
+		batch[batch_cnt] = shared_mmap;
+		kpages[batch_cnt++] = kpage;
+	}
+	sync_batch(batch, kpages, batch_cnt);
+}
+
+/* Marks SHARED_MMAP and all of its users' page table entries as clean,
+ * returning true if any were dirty. The SHARED_MMAP lock must be held and the
+ * page loaded.
+ */
+static bool clean_ptes(struct shared_mmap *shared_mmap)
+{
+	bool dirty = shared_mmap->dirty;
+
+	for (struct list_elem *elem = list_begin(&shared_mmap->users.mappings);
+			 elem != list_end(&shared_mmap->users.mappings);
+			 elem = list_next(elem)) {
+		struct user_mmap *user_mmap =
+						list_entry(elem, struct user_mmap, mapping.elem);
+		if (pagedir_is_dirty(user_mmap->pd, user_mmap->vpage)) {
+			pagedir_set_dirty(user_mmap->pd, user_mmap->vpage, false);
+			dirty = true;
+		}
+	}
+	shared_mmap->dirty = false;
+	return dirty;
+}
+
+/* Writes the PAGE_CNT frame locked KPAGES of consecutive SHARED_MMAPS to their
+ * file, then unlocks the frames.
+ */
+static void sync_batch(struct shared_mmap **shared_mmaps, void **kpages,
+											 size_t page_cnt)
+{
+	if (page_cnt == 0)
+		return;
+
+	filesys_enter();
+	file_seek(shared_mmaps[0]->file, shared_mmaps[0]->file_offset);
+	for (size_t i = 0; i < page_cnt; i++)
+		file_write(shared_mmaps[0]->file, kpages[i], shared_mmaps[i]->length);
+	filesys_exit();
+
+	for (size_t i = 0; i < page_cnt; i++)
+		frame_unlock_mmaped(shared_mmaps[i], kpages[i]);
+}
+
+/* Returns true if the page of NEXT directly follows the whole page of PREV in
+ * the same file.
+ */
+static bool mmap_follows(struct shared_mmap *prev, struct shared_mmap *next)
+{
+	return file_get_inode(prev->file) == file_get_inode(next->file) &&
+				 prev->length == PGSIZE &&
+				 next->file_offset == prev->file_offset + PGSIZE;
+}
+
+/* Gives the copy on write USER_MMAP its own copy of the page, as a writable
+ * swappable page, and unregisters it from its SHARED_MMAP. The copy is taken
+ * from the SHARED_MMAP's frame if loaded, else read from the file. Returns
+ * false if USER_MMAP is not copy on write.
+ */
+bool mmap_copy_on_write(struct user_mmap *user_mmap)
+{
+	if (!user_mmap->private_mmaps)
+		return false;
+
+	struct shared_mmap *shared_mmap = user_mmap->shared_mmap;
+	uint32_t *pd = user_mmap->pd;
+	void *vpage = user_mmap->vpage;
+
+	/* The frame is got before acquiring the SHARED_MMAP lock, as evicting a
+	 * frame may require it.
+	 */
+	void *copy = frame_get();
+
+	/* With the SHARED_MMAP lock acquired, an eviction of the SHARED_MMAP's frame
+	 * cannot finish, so its contents are safe to copy. A page being read in by
+	 * another user is copied once the read is done.
+	 */
+	lock_acquire(&shared_mmap->lock);
+	wait_loaded(shared_mmap);
+	bool loaded = shared_mmap->kpage != NULL;
+	if (loaded)
+		memcpy(copy, shared_mmap->kpage, PGSIZE);
+	lock_release(&shared_mmap->lock);
+
+	/* Copy on write users share read-only mmaps, whose file is denied writes, so
+	 * the copy can be read from the file without the SHARED_MMAP lock. The rest
+	 * of the segment is read with it.
+	 */
+	if (!loaded)
+		read_around(user_mmap, copy);
+
+	mmap_unregister(user_mmap);
+	if (!pagedir_set_page(pd, vpage, copy, true))
+		NOT_REACHED();
+	frame_unlock_swappable(pd, vpage, copy);
+	return true;
+}
+
 /* Evict a frame for an mmaped file, informing all page table entries using it
- * KPAGE must be frame locked before calling. USED_QUEUE_LOCK is used to release
- * access to the used_queue, so that other evictions can occur.
- * USED_QUEUE_LOCK must be released before the funtion returns.
+ * KPAGE must be frame locked before calling. The lock of the frame is held by
+ * the eviction, so that processes cannot lock the frame until the eviction has
+ * taken over the page. It is released (with FRAME_RELEASE()) before the
+ * funtion returns.
  */
-void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap,
-											struct lock *used_queue_lock)
+void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap)
 {
 	lock_acquire(&shared_mmap->lock);
 
-	/* We need to chain the shared mmap lock and the used queue lock here because
+	/* We need to chain the shared mmap lock and the frame's lock here because
 	 * it may be the case that the shared mmap will soon be unregistered and
 	 * we do not want that to happen while we are evicting.
 	 *
@@ -454,16 +1298,17 @@ void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap,
 	 * the fact that, after attempting to lock the frame in the MMAP_UNREGISTER(),
 	 * we acquire the lock for this shared mmap.
 	 */
-	lock_release(used_queue_lock);
+	frame_release(kpage);
+	shared_mmap->kpage = NULL;
 
 	/* Update every page table entry connected to that SHARED_MMAP. Exclusive
 	 * access to each entry is enforced by the SHARED_MMAP lock.
 	 */
-	for (struct list_elem *elem = list_begin(&shared_mmap->user_mmaped_pages);
-			 elem != list_end(&shared_mmap->user_mmaped_pages);
+	for (struct list_elem *elem = list_begin(&shared_mmap->users.mappings);
+			 elem != list_end(&shared_mmap->users.mappings);
 			 elem = list_next(elem)) {
 		struct user_mmap *user_mmap =
-						list_entry(elem, struct user_mmap, shared_mmap_elem);
+						list_entry(elem, struct user_mmap, mapping.elem);
 		pagedir_set_mmaped_page(user_mmap->pd, user_mmap->vpage, user_mmap);
 	}
 
@@ -477,38 +1322,13 @@ void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap,
 	lock_release(&shared_mmap->lock);
 }
 
-/* Checks if the shared page SAHRED_MMAP was accessed by any of its processes.
- * Called in FRAME_GET().
- */
-bool mmap_frame_was_accessed(struct shared_mmap *shared_mmap)
-{
-	lock_acquire(&shared_mmap->lock);
-
-	/* Check if any page table entries using the mmap frame have been accessed. */
-	bool accessed = mmap_or_ptes(shared_mmap, pagedir_is_accessed);
-	lock_release(&shared_mmap->lock);
-	return accessed;
-}
-
-/* Resets the access bits of all user pages sharing the mmaping.
- * Called in FRAME_GET().
+/* Returns the reverse map of the users of SHARED_MMAP. Used by the frame
+ * system to check and reset the page table entries mapping its frame, without
+ * the SHARED_MMAP lock that is held across write backs.
  */
-void mmap_frame_reset_accessed(struct shared_mmap *shared_mmap)
+struct rmap *mmap_frame_rmap(struct shared_mmap *shared_mmap)
 {
-	lock_acquire(&shared_mmap->lock);
-
-	/* Update every page table entry connected to that SHARED_MMAP, setting
-	 * accessed as false. Exclusive access to page table entries is enforced
-	 * through the SHARED_MMAP lock.
-	 */
-	for (struct list_elem *elem = list_begin(&shared_mmap->user_mmaped_pages);
-			 elem != list_end(&shared_mmap->user_mmaped_pages);
-			 elem = list_next(elem)) {
-		struct user_mmap *user_mmap =
-						list_entry(elem, struct user_mmap, shared_mmap_elem);
-		pagedir_set_accessed(user_mmap->pd, user_mmap->vpage, false);
-	}
-	lock_release(&shared_mmap->lock);
+	return &shared_mmap->users;
 }
 
 /* Hashing function for shared_mmap struct. */
@@ -548,6 +1368,91 @@ bool shared_mmap_less_func(const struct hash_elem *a_raw,
 	return file_get_inode(a->file) < file_get_inode(b->file);
 }
 
+/* Returns the shard of MMAPS containing SHARED_MMAP, by the inode and page of
+ * its file. Consecutive pages of a file are in consecutive shards.
+ */
+static struct mmap_shard *shard_of(const struct shared_mmap *shared_mmap)
+{
+	uintptr_t inode = (uintptr_t)file_get_inode(shared_mmap->file);
+	return &shards[(hash_int(inode) + shared_mmap->file_offset / PGSIZE) %
+								 MMAP_SHARDS];
+}
+
+/* Inserts the read-only SHARED_MMAP, which has no users, into the page cache of
+ * its SHARD, allowing writes to its file again. If the shard's cache is full,
+ * its oldest cached page is destroyed. The SHARD's lock must be held, the
+ * SHARED_MMAP lock must not be held (destroying may need to lock frames).
+ */
+static void cache_insert(struct mmap_shard *shard,
+												 struct shared_mmap *shared_mmap)
+{
+	ASSERT(!shared_mmap->writable);
+
+	filesys_enter();
+	shared_mmap->write_cnt =
+					inode_write_count(file_get_inode(shared_mmap->file));
+	file_allow_write(shared_mmap->file);
+	filesys_exit();
+
+	list_push_back(&shard->cache, &shared_mmap->cache_elem);
+	if (++shard->cache_cnt > MMAP_SHARD_CACHE_PAGES) {
+		struct shared_mmap *oldest = list_entry(list_pop_front(&shard->cache),
+																						struct shared_mmap, cache_elem);
+		shard->cache_cnt--;
+		cache_destroy(shard, oldest);
+	}
+}
+
+/* Takes the SHARED_MMAP out of the page cache of its SHARD to be used again,
+ * denying writes to its file. If the file has been written to since it was
+ * cached, the page is stale, so it is destroyed and false is returned. The
+ * SHARD's lock must be held.
+ */
+static bool cache_take(struct mmap_shard *shard,
+											 struct shared_mmap *shared_mmap)
+{
+	list_remove(&shared_mmap->cache_elem);
+	shard->cache_cnt--;
+
+	filesys_enter();
+	bool stale = inode_write_count(file_get_inode(shared_mmap->file)) !=
+							 shared_mmap->write_cnt;
+	if (!stale)
+		file_deny_write(shared_mmap->file);
+	filesys_exit();
+
+	if (stale)
+		cache_destroy(shard, shared_mmap);
+	return !stale;
+}
+
+/* Removes the SHARED_MMAP, which has no users and has been taken out of the
+ * page cache, from its SHARD of the mmap system, freeing its frame. The SHARD's
+ * lock must be held.
+ */
+static void cache_destroy(struct mmap_shard *shard,
+													struct shared_mmap *shared_mmap)
+{
+	/* As in MMAP_UNREGISTER(), with no users and the shard's lock held the page
+	 * cannot be loaded again, so if the frame cannot be locked it has been
+	 * evicted. Acquiring the SHARED_MMAP lock waits for any such eviction to
+	 * finish.
+	 */
+	void *kpage = shared_mmap->kpage;
+	if (kpage && !frame_lock_mmaped(shared_mmap, kpage))
+		kpage = NULL;
+	lock_acquire(&shared_mmap->lock);
+	lock_release(&shared_mmap->lock);
+
+	hash_delete(&shard->mmaps, &shared_mmap->mmap_system_elem);
+	filesys_enter();
+	file_close(shared_mmap->file);
+	filesys_exit();
+	if (kpage)
+		frame_free(kpage);
+	free(shared_mmap);
+}
+
 /* Updates the file that we are mmaping if the file is writable and dirty
  * We do not alter dirty page table entries as the two cases of using this
  * function are:
@@ -573,13 +1478,31 @@ static void write_back(struct shared_mmap *shared_mmap, void *kpage)
 static bool mmap_or_ptes(struct shared_mmap *shared_mmap,
 												 bool (*condition)(uint32_t *, const void *))
 {
-	for (struct list_elem *elem = list_begin(&shared_mmap->user_mmaped_pages);
-			 elem != list_end(&shared_mmap->user_mmaped_pages);
+	for (struct list_elem *elem = list_begin(&shared_mmap->users.mappings);
+			 elem != list_end(&shared_mmap->users.mappings);
 			 elem = list_next(elem)) {
 		struct user_mmap *user_mmap =
-						list_entry(elem, struct user_mmap, shared_mmap_elem);
+						list_entry(elem, struct user_mmap, mapping.elem);
 		if (condition(user_mmap->pd, user_mmap->vpage))
 			return true;
 	}
 	return false;
 }
+
+/* Hashing function for the PRIVATE_MMAPS hashmaps. */
+static unsigned private_hash_func(const struct hash_elem *user_mmap_raw,
+																	void *aux UNUSED)
+{
+	const struct user_mmap *user_mmap =
+					hash_entry(user_mmap_raw, struct user_mmap, private_elem);
+	return hash_bytes(&user_mmap->vpage, sizeof user_mmap->vpage);
+}
+
+/* Comparison function for the PRIVATE_MMAPS hashmaps. */
+static bool private_less_func(const struct hash_elem *a_raw,
+															const struct hash_elem *b_raw, void *aux UNUSED)
+{
+	const struct user_mmap *a = hash_entry(a_raw, struct user_mmap, private_elem);
+	const struct user_mmap *b = hash_entry(b_raw, struct user_mmap, private_elem);
+	return a->vpage < b->vpage;
+}
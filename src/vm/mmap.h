@@ -1,6 +1,7 @@
 #ifndef VM_MMAP_H
 #define VM_MMAP_H
 
+#include <hash.h>
 #include <list.h>
 #include <stdbool.h>
 #include "threads/synch.h"
@@ -8,27 +9,68 @@
 #include "filesys/off_t.h"
 
 struct user_mmap;
+struct mmap_region;
 struct shared_mmap;
+struct rmap;
+
+/* How a process expects to use its mmaped pages, see MMAP_ADVISE(). The values
+ * match the MADV_* advice of the madvise system call (see lib/user/syscall.h).
+ */
+enum mmap_advice {
+	MMAP_NORMAL, /* No special treatment. */
+	MMAP_SEQUENTIAL, /* Read ahead, evict pages behind faults early. */
+	MMAP_WILLNEED, /* Load the pages now. */
+	MMAP_DONTNEED /* Free the frames of clean pages. */
+};
 
 /* Initializes the mmap system */
 void mmap_init(void);
 
+/* A process's hashmap of its copy on write USER_MMAPs. */
+bool mmap_private_init(struct hash *private_mmaps);
+void mmap_private_destroy(struct hash *private_mmaps);
+
 /* Mmap registration. */
 bool mmap_register(struct file *file, off_t offset, int16_t length,
 									 bool writable, uint32_t *pd, void *upage,
 									 struct list *mmaping_list);
+bool mmap_register_private(struct file *file, off_t offset, int16_t length,
+													 uint32_t *pd, void *vpage,
+													 struct list *mmaping_list,
+													 struct hash *private_mmaps);
 void mmap_unregister(struct user_mmap *user_mmap);
+bool mmap_clone_all(struct list *mmaping_list, uint32_t *pd,
+										struct list *new_mmaping_list,
+										struct hash *new_private_mmaps);
+
+/* Mmaped regions of files. */
+bool mmap_register_region(struct file *file, off_t offset, off_t length,
+													uint32_t *pd, void *start,
+													struct mmap_region **region);
+void mmap_unregister_region(struct mmap_region *region);
+bool mmap_clone_region(struct mmap_region *region, uint32_t *pd,
+											 struct mmap_region **new_region);
+struct user_mmap *mmap_region_page(struct mmap_region *region, void *vpage);
+void *mmap_region_start(struct mmap_region *region);
+void *mmap_region_end(struct mmap_region *region);
 
 /* USER_MMAP access from THREAD's bookkeeping list. */
 struct user_mmap *mmap_list_entry(struct list_elem *elem);
+struct user_mmap *mmap_find_private(struct hash *private_mmaps, void *vpage);
 
 /* Load an mmap and set page table entries accordingly. */
 void mmap_load(struct user_mmap *user_mmap);
 
+/* Advise how pages will be used, or write back dirty pages. */
+void mmap_advise(struct mmap_region *region, void *start, void *end,
+								 enum mmap_advice advice);
+void mmap_sync(struct mmap_region *region, void *start, void *end);
+
+/* Give a copy on write user its own copy of the page. */
+bool mmap_copy_on_write(struct user_mmap *user_mmap);
+
 /* Access functions for mmaped pages - used in frame system. */
-void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap,
-											struct lock *used_queue_lock);
-bool mmap_frame_was_accessed(struct shared_mmap *shared_mmap);
-void mmap_frame_reset_accessed(struct shared_mmap *shared_mmap);
+void mmap_frame_evict(void *kpage, struct shared_mmap *shared_mmap);
+struct rmap *mmap_frame_rmap(struct shared_mmap *shared_mmap);
 
 #endif
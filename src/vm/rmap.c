@@ -0,0 +1,111 @@
+#include "vm/rmap.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Reverse maps record every page table entry mapping a shared page (mmaped and
+ * copy on write pages), so that page replacement can find all mappings of a
+ * frame in O(mappers).
+ *
+ * The owner of the shared page (the SHARED_MMAP or COW_PAGE) adds and removes
+ * mappings while holding its own lock, and may iterate MAPPINGS with only that
+ * lock held, as no one else changes it. Page replacement only takes the RMAP's
+ * lock, which is never held across I/O, so checking the accessed bits of a
+ * shared frame never waits on the file system (e.g. for the write back of an
+ * mmaped page being evicted, which holds the SHARED_MMAP lock).
+ *
+ * Each mapping is recorded as a pointer to its PTE, the page directory and
+ * virtual page are found from it (see pagedir_pte_owner()). Swappable frames
+ * have a single mapping, which the frame table records in the same way.
+ */
+
+static bool rmap_any(struct rmap *rmap,
+										 bool (*condition)(uint32_t *pd, const void *vpage));
+
+/* Initialise RMAP with no mappings. */
+void rmap_init(struct rmap *rmap)
+{
+	lock_init(&rmap->lock);
+	list_init(&rmap->mappings);
+}
+
+/* Record MAPPING of the page by VPAGE in PD, whose page table must exist. */
+void rmap_add(struct rmap *rmap, struct rmap_elem *mapping, uint32_t *pd,
+							void *vpage)
+{
+	mapping->pte = pagedir_get_pte(pd, vpage);
+	ASSERT(mapping->pte);
+
+	lock_acquire(&rmap->lock);
+	list_push_back(&rmap->mappings, &mapping->elem);
+	lock_release(&rmap->lock);
+}
+
+/* Remove MAPPING from RMAP. */
+void rmap_remove(struct rmap *rmap, struct rmap_elem *mapping)
+{
+	lock_acquire(&rmap->lock);
+	list_remove(&mapping->elem);
+	lock_release(&rmap->lock);
+}
+
+/* Returns true if nothing maps the page. Only used by the owner of the page. */
+bool rmap_is_empty(struct rmap *rmap)
+{
+	return list_empty(&rmap->mappings);
+}
+
+/* Returns true if exactly one mapping maps the page. Only used by the owner of
+ * the page.
+ */
+bool rmap_is_single(struct rmap *rmap)
+{
+	return !list_empty(&rmap->mappings) &&
+				 list_front(&rmap->mappings) == list_back(&rmap->mappings);
+}
+
+/* Returns true if any mapping of the page has been accessed. */
+bool rmap_was_accessed(struct rmap *rmap)
+{
+	return rmap_any(rmap, pagedir_is_accessed);
+}
+
+/* Resets the accessed bits of every mapping of the page. */
+void rmap_reset_accessed(struct rmap *rmap)
+{
+	lock_acquire(&rmap->lock);
+	for (struct list_elem *elem = list_begin(&rmap->mappings);
+			 elem != list_end(&rmap->mappings); elem = list_next(elem)) {
+		struct rmap_elem *mapping = list_entry(elem, struct rmap_elem, elem);
+		void *vpage;
+		uint32_t *pd = pagedir_pte_owner(mapping->pte, &vpage);
+
+		pagedir_set_accessed(pd, vpage, false);
+	}
+	lock_release(&rmap->lock);
+}
+
+/* Returns true if any process mapping the page has locked it in memory. */
+bool rmap_is_mlocked(struct rmap *rmap)
+{
+	return rmap_any(rmap, pagedir_is_mlocked);
+}
+
+/* Returns true if CONDITION holds for any mapping of the page. */
+static bool rmap_any(struct rmap *rmap,
+										 bool (*condition)(uint32_t *pd, const void *vpage))
+{
+	bool result = false;
+
+	lock_acquire(&rmap->lock);
+	for (struct list_elem *elem = list_begin(&rmap->mappings);
+			 elem != list_end(&rmap->mappings) && !result; elem = list_next(elem)) {
+		struct rmap_elem *mapping = list_entry(elem, struct rmap_elem, elem);
+		void *vpage;
+		uint32_t *pd = pagedir_pte_owner(mapping->pte, &vpage);
+
+		result = condition(pd, vpage);
+	}
+	lock_release(&rmap->lock);
+
+	return result;
+}
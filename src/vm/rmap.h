@@ -0,0 +1,35 @@
+#ifndef VM_RMAP_H
+#define VM_RMAP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* A page table entry mapping a shared page, embedded in the structure that owns
+ * the mapping (e.g. a USER_MMAP or COW_USER).
+ */
+struct rmap_elem {
+	struct list_elem elem; /* Elem of the RMAP's MAPPINGS. */
+	uint32_t *pte; /* The page table entry mapping the page. */
+};
+
+/* The reverse map of a shared page, every page table entry mapping it. */
+struct rmap {
+	struct lock lock; /* Held to change MAPPINGS, or to read it from outside. */
+	struct list mappings; /* List of RMAP_ELEMs. */
+};
+
+void rmap_init(struct rmap *rmap);
+void rmap_add(struct rmap *rmap, struct rmap_elem *mapping, uint32_t *pd,
+							void *vpage);
+void rmap_remove(struct rmap *rmap, struct rmap_elem *mapping);
+bool rmap_is_empty(struct rmap *rmap);
+bool rmap_is_single(struct rmap *rmap);
+
+/* Access functions for the mappings of a frame - used in frame system. */
+bool rmap_was_accessed(struct rmap *rmap);
+void rmap_reset_accessed(struct rmap *rmap);
+bool rmap_is_mlocked(struct rmap *rmap);
+
+#endif
@@ -2,22 +2,70 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <bitmap.h>
+#include <round.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 
 #define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Swap slots are allocated in clusters of SWAP_CLUSTER_PAGES consecutive slots.
+ * Each address space allocates from its own cluster, continuing from the slot
+ * after the last page it swapped out (its cursor, see pagedir_swap_cursor()),
+ * and takes the lowest entirely free cluster when its cluster runs out or
+ * another page has taken the next slot. The pages of a process evicted
+ * together are therefore kept together on disk rather than interleaved with
+ * those of other processes, so they can be read back in one sequential pass
+ * (see SWAP_LOAD_MULTIPLE()). A cluster becomes free again once all its pages
+ * are loaded back or freed. When no cluster is entirely free, the lowest free
+ * slot is used.
+ */
+#define SWAP_CLUSTER_PAGES 16
+
 struct bitmap *is_free_tree; /* An interval tree of whether an entry is used */
 struct bitmap *is_writable; /* Whether an entry is brought back writable */
+struct bitmap *is_busy; /* Whether an entry is still being written to */
+
+/* An interval tree of whether a cluster is entirely free, and the number of
+ * used slots of each cluster. Only the NUM_CLUSTERS whole clusters are in the
+ * tree, a trailing partial cluster is never used as a new cluster.
+ */
+struct bitmap *is_empty_tree;
+static uint8_t *cluster_used_cnts;
+static size_t num_clusters;
 
-struct lock swap_lock; /* Locks our is_free_tree bitmap */
+/* The cursor of copy on write pages, which have no single address space. */
+static swapid_t cow_cursor = SWAPID_NONE;
+
+/* Locks our is_free_tree, is_writable and is_busy bitmaps. The swap I/O itself
+ * is done without it, so that multiple pages can be moved to and from the swap
+ * at once.
+ */
+struct lock swap_lock;
+
+/* Signalled (with SWAP_LOCK) whenever an entry stops being busy. */
+struct condition swap_written;
+
+/* Number of free swap slots not yet reserved by an eviction (see
+ * SWAP_RESERVE()), protected by SWAP_LOCK.
+ */
+static int32_t unreserved_cnt;
 
 _Static_assert(PGSIZE % BLOCK_SECTOR_SIZE == 0,
 							 "Page size must be divisible by block size");
 
 static bool swap_free_impl(swapid_t id);
+static swapid_t swap_alloc_impl(bool writable, swapid_t *cursor);
+static swapid_t swap_cluster_alloc(void);
+static bool swap_is_free(swapid_t id);
+static bool swap_cluster_is_empty(size_t cluster);
+static struct bitmap *tree_create(size_t leaf_cnt);
+static void tree_set(struct bitmap *tree, size_t leaf, bool value);
+static int32_t tree_first(struct bitmap *tree);
+static void swap_write_impl(void *kpage, swapid_t id);
+static void swap_wait_written(swapid_t id);
 
 /* Initializes the swap system. */
 void swap_init(void)
@@ -31,60 +79,54 @@ void swap_init(void)
 	if (num_swap_spaces > (1 << 29))
 		PANIC("Max swap space size handled by the OS is 2TB.");
 
-	int32_t nearest_power_of_two = 1;
-	while (nearest_power_of_two < num_swap_spaces)
-		nearest_power_of_two *= 2;
+	num_clusters = num_swap_spaces / SWAP_CLUSTER_PAGES;
 
-	is_free_tree = bitmap_create(nearest_power_of_two * 2);
+	is_free_tree = tree_create(num_swap_spaces);
 	is_writable = bitmap_create(num_swap_spaces);
+	is_busy = bitmap_create(num_swap_spaces);
+	is_empty_tree = tree_create(num_clusters);
+	cluster_used_cnts = calloc(DIV_ROUND_UP(num_swap_spaces, SWAP_CLUSTER_PAGES),
+														 sizeof *cluster_used_cnts);
 
-	if (!is_free_tree || !is_writable)
-		PANIC("Could not malloc is_free_tree memory or is_writable bitmaps.");
+	if (!is_free_tree || !is_writable || !is_busy || !is_empty_tree ||
+			!cluster_used_cnts)
+		PANIC("Could not malloc the swap slot bitmaps and cluster counts.");
 
-	bitmap_set_multiple(is_free_tree, nearest_power_of_two, num_swap_spaces,
-											true);
+	unreserved_cnt = num_swap_spaces;
+	lock_init(&swap_lock);
+	cond_init(&swap_written);
+}
 
-	for (int i = nearest_power_of_two - 1; i > 0; i--)
-		bitmap_set(is_free_tree, i,
-							 bitmap_test(is_free_tree, i * 2) ||
-											 bitmap_test(is_free_tree, i * 2 + 1));
+/* Reserve a free swap slot for the next SWAP_PAGE_EVICT() or SWAP_STORE(),
+ * returns false if every free slot is already reserved. Page replacement
+ * reserves the slot before choosing to evict a frame to swap, so that running
+ * out of swap space leaves the frame where it is rather than panicking.
+ */
+bool swap_reserve(void)
+{
+	lock_acquire(&swap_lock);
+	bool reserved = unreserved_cnt > 0;
+	if (reserved)
+		unreserved_cnt--;
+	lock_release(&swap_lock);
 
-	lock_init(&swap_lock);
+	return reserved;
 }
 
 /* Finds a free swap slot, sets the pte in the page directory to not present
- * and writes the data from that page into that swap slot. USED_QUEUE_LOCK is
- * used to release access to the used_queue, so that other evictions can occur
- * USED_QUEUE_LOCK must be released before the funtion returns.
+ * and writes the data from that page into that swap slot. The lock of the frame
+ * KPAGE is held by the eviction, so that processes cannot lock the frame until
+ * the eviction has taken over the page. It is released (with FRAME_RELEASE())
+ * before the funtion returns.
  */
-void swap_page_evict(void *kpage, uint32_t *pd, void *vpage,
-										 struct lock *used_queue_lock)
+void swap_page_evict(void *kpage, uint32_t *pd, void *vpage)
 {
 	ASSERT(pg_ofs(kpage) == 0);
 
-	/* Find the first free swap slot. */
+	/* Find a free swap slot in the cluster of the address space. */
 	lock_acquire(&swap_lock);
-
-	int32_t node = 1;
-	if (!bitmap_test(is_free_tree, node))
-		PANIC("Ran out of swap space.");
-
-	int32_t start_of_leaf_nodes = bitmap_size(is_free_tree) / 2;
-	while (node < start_of_leaf_nodes) {
-		if (bitmap_test(is_free_tree, node * 2))
-			node = node * 2;
-		else
-			node = node * 2 + 1;
-	}
-
-	swapid_t new_swap_id = node - start_of_leaf_nodes;
-	bitmap_set(is_free_tree, node, false);
-	bitmap_set(is_writable, new_swap_id, pagedir_is_writable(pd, vpage));
-
-	while (node /= 2)
-		bitmap_set(is_free_tree, node,
-							 bitmap_test(is_free_tree, node * 2) ||
-											 bitmap_test(is_free_tree, node * 2 + 1));
+	swapid_t new_swap_id = swap_alloc_impl(pagedir_is_writable(pd, vpage),
+																				 pagedir_swap_cursor(pd));
 
 	/* Set the page to swapped. We are assuming that this will succeed, since,
 	 * it is being swapped out, then that means that the pte for it should already
@@ -97,60 +139,251 @@ void swap_page_evict(void *kpage, uint32_t *pd, void *vpage,
 	 * that, if a frame lock fails on a swappable page, then that means that it
 	 * is in the swap (its page table entry is set to a field in swap).
 	 */
-	lock_release(used_queue_lock);
+	frame_release(kpage);
+	lock_release(&swap_lock);
 
-	/* Write the page to the allocated swap block */
+	/* Write the page to the allocated swap block. The entry is busy until the
+	 * write is done, so a page fault on the page waits for it in SWAP_LOAD().
+	 */
+	swap_write_impl(kpage, new_swap_id);
+}
+
+/* Writes KPAGE to a free swap slot, recording WRITABLE to be returned when the
+ * slot is loaded. Returns the id of the slot used. Used for pages not owned by
+ * a single page table entry (copy on write pages).
+ */
+swapid_t swap_store(void *kpage, bool writable)
+{
+	ASSERT(pg_ofs(kpage) == 0);
+
+	lock_acquire(&swap_lock);
+	swapid_t new_swap_id = swap_alloc_impl(writable, &cow_cursor);
+	lock_release(&swap_lock);
+
+	swap_write_impl(kpage, new_swap_id);
+	return new_swap_id;
+}
+
+/* Returns the writability recorded for the used swap slot ID. */
+bool swap_is_writable(swapid_t id)
+{
+	lock_acquire(&swap_lock);
+	bool writable = bitmap_test(is_writable, id);
+	lock_release(&swap_lock);
+
+	return writable;
+}
+
+/* Finds and marks as used and busy a free swap slot, recording its WRITABLE
+ * bit. The slot is the one at CURSOR if it is free and continues the cluster
+ * CURSOR is in, otherwise the start of a new cluster, and CURSOR is advanced
+ * past it. The slot must have been reserved with SWAP_RESERVE(), so one is
+ * always free. SWAP_LOCK must be held.
+ */
+static swapid_t swap_alloc_impl(bool writable, swapid_t *cursor)
+{
+	swapid_t new_swap_id = *cursor;
+	if (new_swap_id == SWAPID_NONE || !swap_is_free(new_swap_id) ||
+			(new_swap_id % SWAP_CLUSTER_PAGES == 0 &&
+			 !swap_cluster_is_empty(new_swap_id / SWAP_CLUSTER_PAGES)))
+		new_swap_id = swap_cluster_alloc();
+
+	tree_set(is_free_tree, new_swap_id, false);
+	bitmap_set(is_writable, new_swap_id, writable);
+	bitmap_mark(is_busy, new_swap_id);
+
+	size_t cluster = new_swap_id / SWAP_CLUSTER_PAGES;
+	if (cluster_used_cnts[cluster]++ == 0 && cluster < num_clusters)
+		tree_set(is_empty_tree, cluster, false);
+
+	*cursor = new_swap_id + 1 < (swapid_t)bitmap_size(is_writable) ?
+										new_swap_id + 1 :
+										SWAPID_NONE;
+	return new_swap_id;
+}
+
+/* Returns the first slot of the lowest entirely free cluster, or the lowest
+ * free slot if there is none. SWAP_LOCK must be held.
+ */
+static swapid_t swap_cluster_alloc(void)
+{
+	int32_t cluster = tree_first(is_empty_tree);
+	if (cluster >= 0)
+		return cluster * SWAP_CLUSTER_PAGES;
+
+	int32_t slot = tree_first(is_free_tree);
+	ASSERT(slot >= 0);
+	return slot;
+}
+
+/* Returns true if the swap slot ID is free. SWAP_LOCK must be held. */
+static bool swap_is_free(swapid_t id)
+{
+	return bitmap_test(is_free_tree, bitmap_size(is_free_tree) / 2 + id);
+}
+
+/* Returns true if CLUSTER is a whole cluster with every slot free. SWAP_LOCK
+ * must be held.
+ */
+static bool swap_cluster_is_empty(size_t cluster)
+{
+	return cluster < num_clusters && cluster_used_cnts[cluster] == 0;
+}
+
+/* Writes KPAGE to the busy swap slot ID, then marks it as no longer busy.
+ * SWAP_LOCK must not be held, only the slot's owner accesses it.
+ */
+static void swap_write_impl(void *kpage, swapid_t id)
+{
 	for (int i = 0; i < BLOCKS_PER_PAGE; i++)
-		block_write(block_get_role(BLOCK_SWAP), new_swap_id * BLOCKS_PER_PAGE + i,
+		block_write(block_get_role(BLOCK_SWAP), id * BLOCKS_PER_PAGE + i,
 								kpage + (i * BLOCK_SECTOR_SIZE));
 
+	lock_acquire(&swap_lock);
+	bitmap_reset(is_busy, id);
+	cond_broadcast(&swap_written, &swap_lock);
 	lock_release(&swap_lock);
 }
 
+/* Waits until the swap slot ID has been written to. SWAP_LOCK must be held. */
+static void swap_wait_written(swapid_t id)
+{
+	while (bitmap_test(is_busy, id))
+		cond_wait(&swap_written, &swap_lock);
+}
+
 /* Automatically frees that spot and returns whether the entry is writable */
 bool swap_load(void *page, swapid_t id)
 {
-	ASSERT(pg_ofs(page) == 0);
+	bool was_writable;
 
-	lock_acquire(&swap_lock);
+	swap_load_multiple(&page, id, &was_writable, 1);
+	return was_writable;
+}
 
-	/* Load the page back from the swap */
-	for (int i = 0; i < BLOCKS_PER_PAGE; i++)
-		block_read(block_get_role(BLOCK_SWAP), id * BLOCKS_PER_PAGE + i,
-							 page + (i * BLOCK_SECTOR_SIZE));
+/* Loads the PAGE_CNT consecutive swap slots starting at FIRST_ID into KPAGES in
+ * one sequential read of the swap device, freeing the slots. WRITABLE is set to
+ * whether each entry is writable.
+ */
+void swap_load_multiple(void **kpages, swapid_t first_id, bool *writable,
+												size_t page_cnt)
+{
+	/* The pages may have been evicted so recently that they are still being
+	 * written.
+	 */
+	lock_acquire(&swap_lock);
+	for (size_t i = 0; i < page_cnt; i++) {
+		ASSERT(pg_ofs(kpages[i]) == 0);
+		swap_wait_written(first_id + i);
+	}
+	lock_release(&swap_lock);
 
-	/* Set the previously used swap block as usable */
-	bool was_writable = swap_free_impl(id);
+	/* Load the pages back from the swap, the slots are still used so cannot be
+	 * reallocated while reading.
+	 */
+	block_sector_t sector = first_id * BLOCKS_PER_PAGE;
+	for (size_t i = 0; i < page_cnt; i++)
+		for (int j = 0; j < BLOCKS_PER_PAGE; j++)
+			block_read(block_get_role(BLOCK_SWAP), sector++,
+								 kpages[i] + (j * BLOCK_SECTOR_SIZE));
 
+	/* Set the previously used swap blocks as usable */
+	lock_acquire(&swap_lock);
+	for (size_t i = 0; i < page_cnt; i++)
+		writable[i] = swap_free_impl(first_id + i);
 	lock_release(&swap_lock);
-
-	return was_writable;
 }
 
 /* Free the swap slot. */
 bool swap_free(swapid_t id)
 {
-	/* Update the interval tree with the info that now this swap block is empty */
+	/* Update the interval tree with the info that now this swap block is empty,
+	 * once any write to it is done (so it cannot be reallocated and written to
+	 * by two evictions at once).
+	 */
 	lock_acquire(&swap_lock);
+	swap_wait_written(id);
 	bool was_writable = swap_free_impl(id);
 	lock_release(&swap_lock);
 
 	return was_writable;
 }
 
+/* Free the CNT swap slots in IDS, taking SWAP_LOCK once for all of them. */
+void swap_free_batch(const swapid_t *ids, size_t cnt)
+{
+	if (cnt == 0)
+		return;
+
+	lock_acquire(&swap_lock);
+	for (size_t i = 0; i < cnt; i++) {
+		swap_wait_written(ids[i]);
+		swap_free_impl(ids[i]);
+	}
+	lock_release(&swap_lock);
+}
+
 /* Implementation of the swap_free that does not acquire the lock */
 static bool swap_free_impl(swapid_t id)
 {
 	bool was_writable = bitmap_test(is_writable, id);
 
-	int32_t start_of_leaf_nodes = bitmap_size(is_free_tree) / 2;
-	int32_t node = id + start_of_leaf_nodes;
-	bitmap_set(is_free_tree, node, true);
-	while (node /= 2)
-		bitmap_set(is_free_tree, node, true);
+	tree_set(is_free_tree, id, true);
+	size_t cluster = id / SWAP_CLUSTER_PAGES;
+	if (--cluster_used_cnts[cluster] == 0 && cluster < num_clusters)
+		tree_set(is_empty_tree, cluster, true);
+	unreserved_cnt++;
 	return was_writable;
 }
 
+/* Creates an interval tree with LEAF_CNT leaves, all set. Each node is set if
+ * any leaf below it is. Returns NULL if memory allocation fails.
+ */
+static struct bitmap *tree_create(size_t leaf_cnt)
+{
+	size_t nearest_power_of_two = 1;
+	while (nearest_power_of_two < leaf_cnt)
+		nearest_power_of_two *= 2;
+
+	struct bitmap *tree = bitmap_create(nearest_power_of_two * 2);
+	if (!tree)
+		return NULL;
+
+	bitmap_set_multiple(tree, nearest_power_of_two, leaf_cnt, true);
+	for (size_t i = nearest_power_of_two - 1; i > 0; i--)
+		bitmap_set(tree, i,
+							 bitmap_test(tree, i * 2) || bitmap_test(tree, i * 2 + 1));
+	return tree;
+}
+
+/* Sets LEAF of the interval TREE to VALUE, updating the nodes above it. */
+static void tree_set(struct bitmap *tree, size_t leaf, bool value)
+{
+	size_t node = bitmap_size(tree) / 2 + leaf;
+
+	bitmap_set(tree, node, value);
+	while (node /= 2)
+		bitmap_set(tree, node,
+							 bitmap_test(tree, node * 2) || bitmap_test(tree, node * 2 + 1));
+}
+
+/* Returns the lowest set leaf of the interval TREE, or -1 if none is set. */
+static int32_t tree_first(struct bitmap *tree)
+{
+	size_t node = 1;
+	size_t start_of_leaf_nodes = bitmap_size(tree) / 2;
+
+	if (!bitmap_test(tree, node))
+		return -1;
+	while (node < start_of_leaf_nodes) {
+		if (bitmap_test(tree, node * 2))
+			node = node * 2;
+		else
+			node = node * 2 + 1;
+	}
+	return node - start_of_leaf_nodes;
+}
+
 /* Return true if the page table entry is true. */
 bool swap_page_was_accessed(uint32_t *pd, void *vpage)
 {
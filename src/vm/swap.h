@@ -2,24 +2,37 @@
 #define VM_SWAP_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <bitmap.h>
 #include "vm/frame.h"
 
 typedef int32_t swapid_t;
 
+/* A swap id referring to no swap slot. */
+#define SWAPID_NONE ((swapid_t)-1)
+
 /* Initializes the swap system */
 void swap_init(void);
 
+/* Reserve a slot before evicting a page to swap. */
+bool swap_reserve(void);
+
 /* Automatically frees that spot and returns whether the entry is writable */
 bool swap_load(void *page, swapid_t id);
+void swap_load_multiple(void **kpages, swapid_t first_id, bool *writable,
+												size_t page_cnt);
 
 /* Free the swap slot and returns whether it was writable or not */
 bool swap_free(swapid_t id);
+void swap_free_batch(const swapid_t *ids, size_t cnt);
+
+/* Swap slots not tied to a page table entry (copy on write pages). */
+swapid_t swap_store(void *kpage, bool writable);
+bool swap_is_writable(swapid_t id);
 
 /* Swap access functions - used in frame system. */
-void swap_page_evict(void *kpage, uint32_t *pd, void *vpage,
-										 struct lock *used_queue_lock);
+void swap_page_evict(void *kpage, uint32_t *pd, void *vpage);
 void swap_page_reset_accessed(uint32_t *pd, void *vpage);
 bool swap_page_was_accessed(uint32_t *pd, void *vpage);
 